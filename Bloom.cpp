@@ -1,4 +1,5 @@
 #include "Bloom.h"
+#include "profiler.h"
 
 #include <QtGlobal>
 
@@ -11,74 +12,147 @@
 #include <QVector3D>
 #include <QMatrix4x4>
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <cstring>
 #include <sstream>
 
-MyWindow::~MyWindow()
+// LOD chains, coarsest first. LodBaseLevel is the resolution used before LOD.
+static const int teapotGrids[BloomRenderer::LodLevels]  = { 4, 8, 14, 32 };
+static const int sphereSlices[BloomRenderer::LodLevels] = { 12, 25, 50, 100 };
+static const float sphereRadius = 2.0f;   // of every sphere level and impostor
+
+BloomRenderer::~BloomRenderer()
 {
     if (mProgram != 0) delete mProgram;
+    if (mTessProgram != 0) delete mTessProgram;
+    if (mDepthProgram != 0) delete mDepthProgram;
+    if (mTessDepthProgram != 0) delete mTessDepthProgram;
+    if (mGBufferProgram != 0) delete mGBufferProgram;
+    if (mTessGBufferProgram != 0) delete mTessGBufferProgram;
+    if (mDeferredProgram != 0) delete mDeferredProgram;
+    if (mImpostorProgram != 0) delete mImpostorProgram;
+    if (mImpostorDepthProgram != 0) delete mImpostorDepthProgram;
+    if (mImpostorGBufferProgram != 0) delete mImpostorGBufferProgram;
+    if (mClusterProgram != 0) delete mClusterProgram;
+
+    mGpuTimer.destroy();
+    mOverdraw.destroy();
+
+}
+
+BloomRenderer::BloomRenderer()
+    : mFuncs(0), mProgram(0), mTessProgram(0), mDepthProgram(0), mTessDepthProgram(0),
+      mGBufferProgram(0), mTessGBufferProgram(0), mDeferredProgram(0),
+      mImpostorProgram(0), mImpostorDepthProgram(0), mImpostorGBufferProgram(0), mClusterProgram(0), mInitialized(false), mWidth(800), mHeight(600), mBloomDownscale(8), mGpuTimer(PassCount), mGpuStatsInterval(0), tPrev(0), angle(M_PI / 2.0f),
+      mDisplayMode(true), mGpuTessellation(false), mTessPixelsPerSegment(8.0f),
+      mLodEnabled(true), mLodPixelsPerSegment(8.0f), mLodTriangles(0), mLodBaselineTriangles(0),
+      mFrustumCulling(true), mBoundsDirty(true), mDrawnObjects(0), mCulledObjects(0), mCullNs(0), mRefitNs(0),
+      mPackedVertices(false), mOptimizeIndices(true),
+      mTriangleStrips(false), mUploadedIndexBytes(0), mIndexBytes(0), mWeldTeapot(false),
+      mReleasedMeshBytes(0),
+      mIndirectDraws(false), mDrawCalls(0), mProgramChanges(0), mVaoChanges(0), mMaterialChanges(0),
+      mDepthPrepass(DepthPrepassOff), mDepthPrepassThreshold(1.5f), mDepthPrepassActive(false),
+      mOverdrawCounter(false), mDepthComplexity(0.0f), mDeferredShading(false),
+      mSphereImpostors(false), mSphereIndices(0), mImpostorBuffer(0), mImpostorVao(0), mPoolVao(0), mPoolVbo(0), mPoolIbo(0), mPoolIndexType(GL_UNSIGNED_INT), mPoolMode(GL_TRIANGLES),
+      mObjectIndexBuffer(0), mObjectBuffer(0), mIndirectBuffer(0), mObjectCapacity(0),
+      mLightBuffer(0), mClusterCountBuffer(0), mClusterLightBuffer(0), mClusterSliceScale(0.0f), mClusterSliceBias(0.0f),
+      mTargetFbo(0), bloomBufWidth(800/8), bloomBufHeight(600/8),
+      sigma2(25.0f), aveLum(0)
+{
+    for (int i = 0; i < PassCount; i++)
+        mPassCpuNs[i] = 0;
+
+    ObjectUniforms none = { -1, -1, -1 };
+    mObjectUniforms = mTessObjectUniforms = none;
+    mDepthObjectUniforms = mTessDepthObjectUniforms = none;
+    mGBufferObjectUniforms = mTessGBufferObjectUniforms = none;
+
+    setScene(SceneStore::defaultScene());
+    resize(mWidth, mHeight);
+}
+
+const char *BloomRenderer::passName(int pass)
+{
+    static const char *names[PassCount] = { "pass1", "luminance", "pass2", "pass3", "pass4", "pass5" };
+
+    return (pass >= 0 && pass < PassCount) ? names[pass] : "unknown";
+}
+
+const char *BloomRenderer::depthPrepassName(int mode)
+{
+    static const char *names[] = { "off", "on", "auto" };
+
+    return (mode >= DepthPrepassOff && mode <= DepthPrepassAuto) ? names[mode] : "unknown";
 }
 
-MyWindow::MyWindow()
-    : mProgram(0), currentTimeMs(0), currentTimeS(0), tPrev(0), angle(M_PI / 2.0f), sigma2(25.0f), aveLum(0)
+int BloomRenderer::depthPrepassFromString(const QString &name, bool *ok)
 {
-    setSurfaceType(QWindow::OpenGLSurface);
-    setFlags(Qt::Window | Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowMinMaxButtonsHint | Qt::WindowCloseButtonHint);
+    for (int mode = DepthPrepassOff; mode <= DepthPrepassAuto; mode++)
+        if (name == depthPrepassName(mode)) {
+            if (ok) *ok = true;
+            return mode;
+        }
 
+    if (ok) *ok = false;
+    return DepthPrepassOff;
+}
+
+QSurfaceFormat BloomRenderer::surfaceFormat()
+{
     QSurfaceFormat format;
     format.setDepthBufferSize(24);
     format.setMajorVersion(4);
     format.setMinorVersion(3);
     format.setSamples(4);
     format.setProfile(QSurfaceFormat::CoreProfile);
-    setFormat(format);
-    create();
-
-    resize(800, 600);
 
-    bloomBufWidth  = this->width()/8;
-    bloomBufHeight = this->height()/8;
-
-    mContext = new QOpenGLContext(this);
-    mContext->setFormat(format);
-    mContext->create();
+    return format;
+}
 
-    mContext->makeCurrent( this );
+bool BloomRenderer::initialize()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context)
+    {
+        qWarning( "No current OpenGL context" );
+        return false;
+    }
 
-    mFuncs = mContext->versionFunctions<QOpenGLFunctions_4_3_Core>();
+    mFuncs = context->versionFunctions<QOpenGLFunctions_4_3_Core>();
     if ( !mFuncs )
     {
         qWarning( "Could not obtain OpenGL versions object" );
-        exit( 1 );
+        return false;
     }
     if (mFuncs->initializeOpenGLFunctions() == GL_FALSE)
     {
         qWarning( "Could not initialize core open GL functions" );
-        exit( 1 );
+        return false;
     }
 
     initializeOpenGLFunctions();
 
-    QTimer *repaintTimer = new QTimer(this);
-    connect(repaintTimer, &QTimer::timeout, this, &MyWindow::render);
-    repaintTimer->start(1000/60);
-
-    QTimer *elapsedTimer = new QTimer(this);
-    connect(elapsedTimer, &QTimer::timeout, this, &MyWindow::modCurTime);
-    elapsedTimer->start(1);       
-}
-
-void MyWindow::modCurTime()
-{
-    currentTimeMs++;
-    currentTimeS=currentTimeMs/1000.0f;
-}
+    mGpuTimer.initialize(mFuncs);
+    mOverdraw.initialize(mFuncs);
+    mGpuStatsTimer.start();
 
-void MyWindow::initialize()
-{
     CreateVertexBuffer();
     initShaders();
+    initTessShaders();
+    initClusterShader();
+    initDeferredShaders();
+    initImpostorShaders();
+
+    // Fixed for the lifetime of the meshes, see setPackedVertices()
+    mProgram->bind();
+    mProgram->setUniformValue("OctNormals", mPackedVertices);
+    mProgram->release();
+    mGBufferProgram->bind();
+    mGBufferProgram->setUniformValue("OctNormals", mPackedVertices);
+    mGBufferProgram->release();
+
     pass1Index = mFuncs->glGetSubroutineIndex( mProgram->programId(), GL_FRAGMENT_SHADER, "pass1");
     pass2Index = mFuncs->glGetSubroutineIndex( mProgram->programId(), GL_FRAGMENT_SHADER, "pass2");
     pass3Index = mFuncs->glGetSubroutineIndex( mProgram->programId(), GL_FRAGMENT_SHADER, "pass3");
@@ -92,139 +166,124 @@ void MyWindow::initialize()
 
     glFrontFace(GL_CCW);
     glEnable(GL_DEPTH_TEST);
+    // The largest index of the index type ends a strip; lists never use it,
+    // VertexFormat::pack keeps 0xffff free
+    glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+
+    mInitialized = true;
+    return true;
 }
 
-void MyWindow::CreateVertexBuffer()
+// Box around every level of a chain: all vertices lie on the same surface,
+// but each level samples it at different points
+static void chainBounds(LodChain &chain)
 {
-    // *** Teapot
-    mFuncs->glGenVertexArrays(1, &mVAOTeapot);
-    mFuncs->glBindVertexArray(mVAOTeapot);
+    chain.boundsMin = chain.levels[0].boundsMin;
+    chain.boundsMax = chain.levels[0].boundsMax;
+    for (int l = 1; l < chain.levels.size(); l++)
+        for (int c = 0; c < 3; c++) {
+            chain.boundsMin[c] = qMin(chain.boundsMin[c], chain.levels[l].boundsMin[c]);
+            chain.boundsMax[c] = qMax(chain.boundsMax[c], chain.levels[l].boundsMax[c]);
+        }
+}
 
+void BloomRenderer::CreateVertexBuffer()
+{
+    PROFILE_ZONE("CreateVertexBuffer");
+    // *** Teapot, one level per grid size
     QMatrix4x4 transform;
     //transform.translate(QVector3D(0.0f, 1.5f, 0.25f));
-    mTeapot = new Teapot(14, transform);
-
-    // Create and populate the buffer objects
-    unsigned int TeapotHandles[4];
-    glGenBuffers(4, TeapotHandles);
-
-    glBindBuffer(GL_ARRAY_BUFFER, TeapotHandles[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mTeapot->getnVerts()) * sizeof(float), mTeapot->getv(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, TeapotHandles[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mTeapot->getnVerts()) * sizeof(float), mTeapot->getn(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, TeapotHandles[2]);
-    glBufferData(GL_ARRAY_BUFFER, (2 * mTeapot->getnVerts()) * sizeof(float), mTeapot->gettc(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TeapotHandles[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * mTeapot->getnFaces() * sizeof(unsigned int), mTeapot->getelems(), GL_STATIC_DRAW);
-
-    // Setup the VAO
-    // Vertex positions
-    mFuncs->glBindVertexBuffer(0, TeapotHandles[0], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(0, 0);
-
-    // Vertex normals
-    mFuncs->glBindVertexBuffer(1, TeapotHandles[1], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(1, 1);
-
-    // vertex texture coord
-    mFuncs->glBindVertexBuffer(2, TeapotHandles[2], 0, sizeof(GLfloat) * 2);
-    mFuncs->glVertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(2, 2);
-
-    // Indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TeapotHandles[3]);
+    for (int l = 0; l < LodLevels; l++) {
+        QByteArray params = meshParams(QString("teapot grid %1 weld %2").arg(teapotGrids[l]).arg(int(mWeldTeapot)));
+        params.append(reinterpret_cast<const char *>(transform.constData()), 16 * sizeof(float));
+        MeshBuffers mesh;
+        if (!loadCachedMesh(params, mesh)) {
+            Teapot teapot(teapotGrids[l], transform, true, true, mTriangleStrips);
+            if (mWeldTeapot)
+                weldTeapot(&teapot, teapotGrids[l]);
+            mesh = uploadMesh(params, teapot.takeData());
+        }
 
-    mFuncs->glBindVertexArray(0);
+        mTeapotLod.levels << mesh;
+        // Pixels per grid segment: about four patches span the teapot
+        mTeapotLod.maxPixels << mLodPixelsPerSegment * 4 * teapotGrids[l];
+    }
+    mTeapotLod.center = mTeapotLod.levels[LodBaseLevel].center;
+    mTeapotLod.radius = mTeapotLod.levels[LodBaseLevel].radius;
+    chainBounds(mTeapotLod);
 
     // *** Plane
-    mFuncs->glGenVertexArrays(1, &mVAOPlane);
-    mFuncs->glBindVertexArray(mVAOPlane);
-
-    mPlane = new VBOPlane(20.0f, 10.0f, 1.0, 1.0);
-
-    // Create and populate the buffer objects
-    unsigned int PlaneHandles[4];
-    glGenBuffers(4, PlaneHandles);
-
-    glBindBuffer(GL_ARRAY_BUFFER, PlaneHandles[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mPlane->getnVerts()) * sizeof(float), mPlane->getv(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, PlaneHandles[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mPlane->getnVerts()) * sizeof(float), mPlane->getn(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, TeapotHandles[2]);
-    glBufferData(GL_ARRAY_BUFFER, (2 * mPlane->getnVerts()) * sizeof(float), mPlane->gettc(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, PlaneHandles[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * mPlane->getnFaces() * sizeof(unsigned int), mPlane->getelems(), GL_STATIC_DRAW);
-
-    // Setup the VAO
-    // Vertex positions
-    mFuncs->glBindVertexBuffer(0, PlaneHandles[0], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(0, 0);
+    QByteArray planeParams = meshParams("plane 20 10 1 1");
+    if (!loadCachedMesh(planeParams, mPlaneMesh)) {
+        VBOPlane plane(20.0f, 10.0f, 1.0, 1.0, 1.0f, 1.0f, mTriangleStrips);
+        mPlaneMesh = uploadMesh(planeParams, plane.takeData());
+    }
 
-    // Vertex normals
-    mFuncs->glBindVertexBuffer(1, PlaneHandles[1], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(1, 1);
+    // *** Sphere, one level per slice count
+    for (int l = 0; l < LodLevels; l++) {
+        QByteArray params = meshParams(QString("sphere 2 %1 %1").arg(sphereSlices[l]));
+        MeshBuffers mesh;
+        if (!loadCachedMesh(params, mesh)) {
+            VBOSphere sphere(sphereRadius, sphereSlices[l], sphereSlices[l], mTriangleStrips);
+            mesh = uploadMesh(params, sphere.takeData());
+        }
 
-    // vertex texture coord
-    mFuncs->glBindVertexBuffer(2, PlaneHandles[2], 0, sizeof(GLfloat) * 2);
-    mFuncs->glVertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(2, 2);
+        mSphereLod.levels << mesh;
+        // Half the slices are seen across the silhouette
+        mSphereLod.maxPixels << mLodPixelsPerSegment * sphereSlices[l] / 2;
+    }
+    mSphereLod.center = mSphereLod.levels[LodBaseLevel].center;
+    mSphereLod.radius = mSphereLod.levels[LodBaseLevel].radius;
+    chainBounds(mSphereLod);
 
-    // Indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, PlaneHandles[3]);
+    buildMeshPool();
 
-    mFuncs->glBindVertexArray(0);
+    qDebug().nospace() << "mesh data: " << mReleasedMeshBytes / 1024 << " KB freed after upload";
 
-    // *** Sphere
-    mFuncs->glGenVertexArrays(1, &mVAOSphere);
-    mFuncs->glBindVertexArray(mVAOSphere);
+    if (mMeshCache.enabled())
+        qDebug().nospace() << "mesh cache " << mMeshCache.directory() << ": " << mMeshCache.hits() << " hits, "
+                           << mMeshCache.misses() << " generated";
 
-    mSphere = new VBOSphere(2.0f, 50, 50);
+    // Only meshes generated this run are reordered, cached ones are not counted
+    if (mCacheBefore.triangles > 0)
+        qDebug().nospace() << "index order: ACMR " << mCacheBefore.acmr() << " -> " << mCacheAfter.acmr()
+                           << ", ATVR " << mCacheBefore.atvr() << " -> " << mCacheAfter.atvr();
 
-    // Create and populate the buffer objects
-    unsigned int SphereHandles[4];
-    glGenBuffers(4, SphereHandles);
+    // Meshes loaded from the cache are not counted
+    if (mUploadedCache.triangles > 0)
+        qDebug().nospace() << "indices: " << mUploadedIndexBytes / 1024 << " KB as triangle "
+                           << (mTriangleStrips ? "strips" : "lists") << " for " << mUploadedCache.triangles
+                           << " triangles, " << mUploadedCache.misses << " vertex fetches, ACMR "
+                           << mUploadedCache.acmr() << ", ATVR " << mUploadedCache.atvr();
 
-    glBindBuffer(GL_ARRAY_BUFFER, SphereHandles[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mSphere->getnVerts()) * sizeof(float), mSphere->getv(), GL_STATIC_DRAW);
+    if (mPackedVertices)
+        qDebug().nospace() << "packed vertices: " << mPackStats.packedBytes / 1024 << " KB vs "
+                           << mPackStats.floatBytes / 1024 << " KB as floats, "
+                           << (mPackStats.floatBytes - mPackStats.packedBytes) / 1024 << " KB saved; max normal error "
+                           << mPackStats.maxNormalError << " deg, max tex coord error " << mPackStats.maxTexCoordError;
 
-    glBindBuffer(GL_ARRAY_BUFFER, SphereHandles[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mSphere->getnVerts()) * sizeof(float), mSphere->getn(), GL_STATIC_DRAW);
+    // *** Teapot control points for GPU tessellation
+    QVector<float> patchPoints = Teapot::patchControlPoints(transform);
+    mTeapotPatchVerts = patchPoints.size() / 3;
 
-    glBindBuffer(GL_ARRAY_BUFFER, TeapotHandles[2]);
-    glBufferData(GL_ARRAY_BUFFER, (2 * mPlane->getnVerts()) * sizeof(float), mSphere->gettc(), GL_STATIC_DRAW);
+    mFuncs->glGenVertexArrays(1, &mVAOTeapotPatches);
+    mFuncs->glBindVertexArray(mVAOTeapotPatches);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, SphereHandles[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mSphere->getnFaces() * sizeof(unsigned int), mSphere->getelems(), GL_STATIC_DRAW);
+    GLuint patchHandle;
+    glGenBuffers(1, &patchHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, patchHandle);
+    glBufferData(GL_ARRAY_BUFFER, patchPoints.size() * sizeof(float), patchPoints.constData(), GL_STATIC_DRAW);
 
-    // Setup the VAO
-    // Vertex positions
-    mFuncs->glBindVertexBuffer(0, SphereHandles[0], 0, sizeof(GLfloat) * 3);
+    mFuncs->glBindVertexBuffer(0, patchHandle, 0, sizeof(GLfloat) * 3);
     mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
     mFuncs->glVertexAttribBinding(0, 0);
+    glEnableVertexAttribArray(0);
 
-    // Vertex normals
-    mFuncs->glBindVertexBuffer(1, SphereHandles[1], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(1, 1);
-
-    // vertex texture coord
-    mFuncs->glBindVertexBuffer(2, SphereHandles[2], 0, sizeof(GLfloat) * 2);
-    mFuncs->glVertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(2, 2);
-
-    // Indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, SphereHandles[3]);
+    mFuncs->glBindVertexArray(0);
 
+    qDebug() << "teapot: mesh" << mTeapotLod.levels[LodBaseLevel].bytes / 1024 << "KB;"
+             << "GPU patches" << mTeapotPatchVerts << "control points,"
+             << patchPoints.size() * 4 / 1024 << "KB";
 
     // *** Array for full-screen quad
     GLfloat verts[] = {
@@ -265,217 +324,1200 @@ void MyWindow::CreateVertexBuffer()
 
 }
 
-void MyWindow::initMatrices()
+QByteArray BloomRenderer::meshParams(const QString &generator) const
 {
-    ModelMatrixTeapot.translate( 3.0f, -5.0f, 1.5f);
-    ModelMatrixTeapot.rotate( -90.0f, QVector3D(1.0f, 0.0f, 0.0f));
+    // Everything that changes the uploaded bytes belongs in here
+    return QString("%1 | packed %2 indexopt %3 strips %4").arg(generator).arg(int(mPackedVertices))
+            .arg(int(mOptimizeIndices)).arg(int(mTriangleStrips)).toUtf8();
+}
 
-    ModelMatrixSphere.translate( -3.0f, -3.0f, 2.0f);
+bool BloomRenderer::loadCachedMesh(const QByteArray &params, MeshBuffers &mesh)
+{
+    MeshPayload payload;
+    if (!mMeshCache.load(params, payload))
+        return false;
 
-    ModelMatrixBackPlane.rotate(90.0f, QVector3D(1.0f, 0.0f, 0.0f));
-    ModelMatrixBotPlane.translate(0.0f, -5.0f, 0.0f);
-    ModelMatrixTopPlane.translate(0.0f,  5.0f, 0.0f);
-    ModelMatrixTopPlane.rotate(180.0f, 1.0f, 0.0f, 0.0f);
+    bool ok = payload.layout == quint32(mPackedVertices ? MeshPayload::Packed : MeshPayload::SeparateFloats);
+    if (ok)
+        mesh = uploadPayload(payload);
+    mMeshCache.release();
 
-    //ModelMatrixPlane.translate(0.0f, -0.45f, 0.0f);
+    return ok;
+}
 
-    ViewMatrix.lookAt(QVector3D(2.0f, 0.0f, 14.0f), QVector3D(0.0f,0.0f,0.0f), QVector3D(0.0f,1.0f,0.0f));
+MeshBuffers BloomRenderer::uploadMesh(const QByteArray &params, MeshData &&data)
+{
+    const float *v  = data.positions();
+    const float *n  = data.normals();
+    const float *tc = data.texCoords();
+    const unsigned int *elems = data.indices();
+    int nVerts   = data.vertexCount();
+    int nIndices = data.indexCount();
+
+    MeshPayload payload;
+    payload.nVerts   = nVerts;
+    payload.nIndices = nIndices;
+    payload.mode     = data.strips() ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+    LodSelector::boundingSphere(v, nVerts, payload.center, payload.radius);
+    payload.boundsMin = QVector3D(data.boundsMin()[0], data.boundsMin()[1], data.boundsMin()[2]);
+    payload.boundsMax = QVector3D(data.boundsMax()[0], data.boundsMax()[1], data.boundsMax()[2]);
+
+    // Reorder in place for the post-transform cache, the CPU copy is dropped
+    // after upload anyway. Strips walk the grids row by row, which the cache
+    // already likes, and the optimizers only take lists.
+    if (data.strips()) {
+        mUploadedCache.add(MeshOptimizer::analyzeStripCache(elems, nIndices, nVerts));
+    } else if (mOptimizeIndices) {
+        mCacheBefore.add(MeshOptimizer::analyzeCache(elems, nIndices, nVerts));
+        MeshOptimizer::optimizeVertexCache(data.indices(), nIndices, nVerts);
+        MeshOptimizer::optimizeOverdraw(data.indices(), nIndices, v, nVerts);
+        CacheStats after = MeshOptimizer::analyzeCache(elems, nIndices, nVerts);
+        mCacheAfter.add(after);
+        mUploadedCache.add(after);
+    } else {
+        mUploadedCache.add(MeshOptimizer::analyzeCache(elems, nIndices, nVerts));
+    }
+
+    PackedMesh packed;
+    QVector<float> floats;
+    if (mPackedVertices) {
+        packed = VertexFormat::pack(v, n, tc, nVerts, elems, nIndices);
+        mPackStats.add(packed.stats);
+
+        payload.layout      = MeshPayload::Packed;
+        payload.vertexData  = packed.vertices.constData();
+        payload.vertexBytes = packed.vertices.size() * sizeof(PackedVertex);
+        payload.indexType   = packed.indexType;
+        payload.indexData   = packed.indexData();
+        payload.indexBytes  = packed.indexBytes();
+    } else {
+        // The three arrays back to back in one buffer
+        floats.resize(8 * nVerts);
+        std::memcpy(floats.data(),              v,  3 * nVerts * sizeof(float));
+        std::memcpy(floats.data() + 3 * nVerts, n,  3 * nVerts * sizeof(float));
+        std::memcpy(floats.data() + 6 * nVerts, tc, 2 * nVerts * sizeof(float));
+
+        payload.layout      = MeshPayload::SeparateFloats;
+        payload.vertexData  = floats.constData();
+        payload.vertexBytes = floats.size() * sizeof(float);
+        payload.indexType   = GL_UNSIGNED_INT;
+        payload.indexData   = elems;
+        payload.indexBytes  = nIndices * sizeof(unsigned int);
+    }
+
+    mUploadedIndexBytes += payload.indexBytes;
+
+    if (mMeshCache.enabled())
+        mMeshCache.save(params, payload);
+
+    MeshBuffers mesh = uploadPayload(payload);
+
+    // glBufferData has copied everything
+    mReleasedMeshBytes += data.bytes();
+    data.release();
+
+    return mesh;
 }
 
-void MyWindow::resizeEvent(QResizeEvent *)
+// Triangles the index data of payload draws, each strip two fewer than
+// its indices
+static GLsizei triangleCount(const MeshPayload &payload)
 {
-    mUpdateSize = true;
+    if (payload.mode != GL_TRIANGLE_STRIP)
+        return payload.nIndices / 3;
+
+    const quint16      *indices16 = static_cast<const quint16 *>(payload.indexData);
+    const unsigned int *indices32 = static_cast<const unsigned int *>(payload.indexData);
+    GLsizei triangles = 0;
+    int length = 0;
+    for (int i = 0; i <= payload.nIndices; i++) {
+        bool restart = i == payload.nIndices
+                    || (payload.indexType == GL_UNSIGNED_SHORT ? indices16[i] == 0xffff
+                                                               : indices32[i] == MeshData::RestartIndex);
+        if (!restart) {
+            length++;
+            continue;
+        }
+        triangles += qMax(0, length - 2);
+        length = 0;
+    }
+    return triangles;
+}
 
-    ProjectionMatrix.setToIdentity();
-    ProjectionMatrix.perspective(60.0f, (float)this->width()/(float)this->height(), 0.3f, 100.0f);
+MeshBuffers BloomRenderer::uploadPayload(const MeshPayload &payload)
+{
+    MeshBuffers mesh;
+    mesh.indexCount  = payload.nIndices;
+    mesh.indexType   = payload.indexType;
+    mesh.mode        = payload.mode;
+    mesh.triangleCount = triangleCount(payload);
+    mesh.vertexCount = payload.nVerts;
+    mesh.layout      = payload.layout;
+    mesh.bytes       = payload.vertexBytes + payload.indexBytes;
+    mesh.center      = payload.center;
+    mesh.radius      = payload.radius;
+    mesh.boundsMin   = payload.boundsMin;
+    mesh.boundsMax   = payload.boundsMax;
+
+    mFuncs->glGenVertexArrays(1, &mesh.vao);
+    mFuncs->glBindVertexArray(mesh.vao);
+
+    // Create and populate the buffer objects
+    unsigned int handles[2];
+    glGenBuffers(2, handles);
+    mesh.vbo = handles[0];
+    mesh.ibo = handles[1];
+
+    glBindBuffer(GL_ARRAY_BUFFER, handles[0]);
+    glBufferData(GL_ARRAY_BUFFER, payload.vertexBytes, payload.vertexData, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handles[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, payload.indexBytes, payload.indexData, GL_STATIC_DRAW);
+
+    setupVertexFormat(payload.layout, handles[0], payload.nVerts);
+
+    mFuncs->glBindVertexArray(0);
+
+    return mesh;
 }
 
-void MyWindow::render()
+// Attribute formats of the bound VAO for vertex data laid out as in
+// MeshPayload, nVerts vertices in vbo
+void BloomRenderer::setupVertexFormat(quint32 layout, GLuint vbo, int nVerts)
 {
-    if(!isVisible() || !isExposed())
-        return;
+    if (layout == MeshPayload::Packed) {
+        // One interleaved binding for all three attributes
+        mFuncs->glBindVertexBuffer(0, vbo, 0, sizeof(PackedVertex));
+        mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, offsetof(PackedVertex, position));
+        mFuncs->glVertexAttribBinding(0, 0);
+        mFuncs->glVertexAttribFormat(1, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, normal));
+        mFuncs->glVertexAttribBinding(1, 0);
+        mFuncs->glVertexAttribFormat(2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, texCoord));
+        mFuncs->glVertexAttribBinding(2, 0);
+    } else {
+        GLintptr n = nVerts;
+
+        // Vertex positions
+        mFuncs->glBindVertexBuffer(0, vbo, 0, sizeof(GLfloat) * 3);
+        mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+        mFuncs->glVertexAttribBinding(0, 0);
+
+        // Vertex normals
+        mFuncs->glBindVertexBuffer(1, vbo, 3 * n * sizeof(GLfloat), sizeof(GLfloat) * 3);
+        mFuncs->glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, 0);
+        mFuncs->glVertexAttribBinding(1, 1);
+
+        // vertex texture coord
+        mFuncs->glBindVertexBuffer(2, vbo, 6 * n * sizeof(GLfloat), sizeof(GLfloat) * 2);
+        mFuncs->glVertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, 0);
+        mFuncs->glVertexAttribBinding(2, 2);
+    }
+}
+
+// Moves every mesh into one vertex and one index buffer, so that pass1 can
+// draw all of them from a single VAO. The data is copied on the GPU; the
+// per-mesh buffers are deleted afterwards.
+void BloomRenderer::buildMeshPool()
+{
+    QVector<MeshBuffers *> meshes;
+    for (int i = 0; i < mTeapotLod.levels.size(); i++)
+        meshes << &mTeapotLod.levels[i];
+    for (int i = 0; i < mSphereLod.levels.size(); i++)
+        meshes << &mSphereLod.levels[i];
+    meshes << &mPlaneMesh;
+
+    GLenum indexType = meshes[0]->indexType;
+    quint32 layout   = meshes[0]->layout;
+    GLenum mode      = meshes[0]->mode;
+    GLintptr totalVerts = 0, totalIndices = 0;
+    for (int i = 0; i < meshes.size(); i++) {
+        if (meshes[i]->indexType != indexType || meshes[i]->layout != layout || meshes[i]->mode != mode) {
+            qWarning() << "mesh pool: meshes differ in index type, layout or mode, drawing them one by one";
+            return;
+        }
+        totalVerts   += meshes[i]->vertexCount;
+        totalIndices += meshes[i]->indexCount;
+    }
+
+    // baseVertex is added after the index fetch, so 16-bit indices stay
+    // valid however large the pool grows
+    const GLintptr indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+
+    // Per-vertex streams in the pool: one interleaved stream, or the
+    // positions, normals and tex coords one after another as in a mesh
+    QVector<GLintptr> streamSizes;
+    if (layout == MeshPayload::Packed)
+        streamSizes << GLintptr(sizeof(PackedVertex));
+    else
+        streamSizes << 3 * GLintptr(sizeof(GLfloat)) << 3 * GLintptr(sizeof(GLfloat)) << 2 * GLintptr(sizeof(GLfloat));
+
+    GLintptr vertexStride = 0;
+    for (int s = 0; s < streamSizes.size(); s++)
+        vertexStride += streamSizes[s];
+
+    glGenBuffers(1, &mPoolVbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mPoolVbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, totalVerts * vertexStride, NULL, GL_STATIC_DRAW);
+
+    GLint baseVertex = 0;
+    for (int i = 0; i < meshes.size(); i++) {
+        MeshBuffers *mesh = meshes[i];
+        glBindBuffer(GL_COPY_READ_BUFFER, mesh->vbo);
+
+        GLintptr readOffset = 0, streamStart = 0;
+        for (int s = 0; s < streamSizes.size(); s++) {
+            GLintptr bytes = mesh->vertexCount * streamSizes[s];
+            mFuncs->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                        readOffset, streamStart + baseVertex * streamSizes[s], bytes);
+            readOffset  += bytes;
+            streamStart += totalVerts * streamSizes[s];
+        }
+
+        mesh->baseVertex = baseVertex;
+        baseVertex += mesh->vertexCount;
+    }
 
-    if (!mContext->makeCurrent(this))
+    glGenBuffers(1, &mPoolIbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mPoolIbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, totalIndices * indexSize, NULL, GL_STATIC_DRAW);
+
+    GLuint firstIndex = 0;
+    for (int i = 0; i < meshes.size(); i++) {
+        MeshBuffers *mesh = meshes[i];
+        glBindBuffer(GL_COPY_READ_BUFFER, mesh->ibo);
+        mFuncs->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                    0, firstIndex * indexSize, mesh->indexCount * indexSize);
+        mesh->firstIndex = firstIndex;
+        firstIndex += mesh->indexCount;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    mFuncs->glGenVertexArrays(1, &mPoolVao);
+    mFuncs->glBindVertexArray(mPoolVao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mPoolIbo);
+    setupVertexFormat(layout, mPoolVbo, totalVerts);
+
+    // Slot of the drawn object in the Objects buffer, one per instance;
+    // glMultiDrawElementsIndirect starts each command at its baseInstance
+    mFuncs->glVertexAttribIFormat(3, 1, GL_UNSIGNED_INT, 0);
+    mFuncs->glVertexAttribBinding(3, 3);
+    mFuncs->glVertexBindingDivisor(3, 1);
+    glEnableVertexAttribArray(3);
+    mFuncs->glBindVertexArray(0);
+
+    glGenBuffers(1, &mObjectBuffer);
+    glGenBuffers(1, &mIndirectBuffer);
+    reserveObjects(64);
+
+    // Every mesh now draws from the pool
+    for (int i = 0; i < meshes.size(); i++) {
+        MeshBuffers *mesh = meshes[i];
+        mFuncs->glDeleteVertexArrays(1, &mesh->vao);
+        glDeleteBuffers(1, &mesh->vbo);
+        glDeleteBuffers(1, &mesh->ibo);
+        mesh->vao = mPoolVao;
+        mesh->vbo = mPoolVbo;
+        mesh->ibo = mPoolIbo;
+    }
+    mPoolIndexType = indexType;
+    mPoolMode      = mode;
+
+    qDebug() << "mesh pool:" << meshes.size() << "meshes," << totalVerts << "vertices,"
+             << totalIndices << "indices in one VAO";
+}
+
+// Grows the per-instance object index buffer of the pool VAO to at least
+// count entries
+void BloomRenderer::reserveObjects(int count)
+{
+    if (count <= mObjectCapacity)
         return;
 
-    static bool initialized = false;
-    if (!initialized) {
-        initialize();
-        initialized = true;
+    int capacity = qMax(count, 2 * mObjectCapacity);
+    QVector<GLuint> slots(capacity);
+    for (int i = 0; i < capacity; i++)
+        slots[i] = i;
+
+    if (mObjectIndexBuffer == 0)
+        glGenBuffers(1, &mObjectIndexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mObjectIndexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GLuint), slots.constData(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    mFuncs->glBindVertexArray(mPoolVao);
+    mFuncs->glBindVertexBuffer(3, mObjectIndexBuffer, 0, sizeof(GLuint));
+    mFuncs->glBindVertexArray(0);
+
+    mObjectCapacity = capacity;
+}
+
+void BloomRenderer::weldTeapot(Teapot *teapot, int grid)
+{
+    int nIndices = teapot->getnElems();
+    int vertsBefore = teapot->getnVerts();
+    const unsigned int *elems = teapot->getelems();
+    CacheStats before = mTriangleStrips ? MeshOptimizer::analyzeStripCache(elems, nIndices, vertsBefore)
+                                        : MeshOptimizer::analyzeCache(elems, nIndices, vertsBefore);
+
+    teapot->weld();
+
+    int vertsAfter = teapot->getnVerts();
+    CacheStats after = mTriangleStrips ? MeshOptimizer::analyzeStripCache(elems, nIndices, vertsAfter)
+                                       : MeshOptimizer::analyzeCache(elems, nIndices, vertsAfter);
+
+    // VBO size in the layout uploadMesh uses: a PackedVertex, or 8 floats
+    // in the separate position, normal and tex coord arrays
+    int stride = mPackedVertices ? int(sizeof(PackedVertex)) : int(8 * sizeof(float));
+    qDebug().nospace() << "weld: teapot grid " << grid << " " << vertsBefore << " -> " << vertsAfter << " vertices, "
+                       << vertsBefore * stride / 1024 << " -> " << vertsAfter * stride / 1024
+                       << " KB, cache hit rate " << 100.0f * (1.0f - float(before.misses) / nIndices) << "% -> "
+                       << 100.0f * (1.0f - float(after.misses) / nIndices) << "%";
+}
+
+int BloomRenderer::selectLod(const LodChain &chain, int object)
+{
+    int level = LodBaseLevel;
+    if (mLodEnabled) {
+        // Bounding sphere into view space straight from the model elements;
+        // the view is rigid, so the radius only takes the model scale
+        float world[3];
+        for (int r = 0; r < 3; r++)
+            world[r] = mScene.modelElement(4*r)[object] * chain.center.x()
+                     + mScene.modelElement(4*r + 1)[object] * chain.center.y()
+                     + mScene.modelElement(4*r + 2)[object] * chain.center.z()
+                     + mScene.modelElement(4*r + 3)[object];
+        QVector3D center = ViewMatrix.map(QVector3D(world[0], world[1], world[2]));
+        level = mObjectLod[object].select(chain, LodSelector::projectedDiameter(center, chain.radius * mScene.scale(object),
+                                                                                ProjectionMatrix, mHeight));
     }
 
-    if (mUpdateSize) {
-        glViewport(0, 0, size().width(), size().height());
-        mUpdateSize = false;
+    const MeshBuffers &mesh = chain.levels[level];
+    mLodTriangles         += mesh.triangleCount;
+    mLodBaselineTriangles += chain.levels[LodBaseLevel].triangleCount;
+
+    return level;
+}
+
+void BloomRenderer::initMatrices()
+{
+    // Object transforms come with the scene, see setScene()
+    ViewMatrix.lookAt(QVector3D(2.0f, 0.0f, 14.0f), QVector3D(0.0f,0.0f,0.0f), QVector3D(0.0f,1.0f,0.0f));
+}
+
+void BloomRenderer::resize(int w, int h)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    mWidth  = w;
+    mHeight = h;
+
+    bloomBufWidth  = qMax(1, mWidth/mBloomDownscale);
+    bloomBufHeight = qMax(1, mHeight/mBloomDownscale);
+
+    ProjectionMatrix.setToIdentity();
+    ProjectionMatrix.perspective(60.0f, (float)mWidth/(float)mHeight, 0.3f, 100.0f);
+
+    // The offscreen targets are sized to the viewport, rebuild them
+    if (mInitialized) {
+        deleteFBO();
+        setupFBO();
     }
+}
+
+void BloomRenderer::setSceneState(const SceneState &state)
+{
+    if (state.width != mWidth || state.height != mHeight)
+        resize(state.width, state.height);
+
+    ViewMatrix             = state.viewMatrix;
+    ProjectionMatrix       = state.projectionMatrix;
+    mDisplayMode           = state.displayMode;
+    mGpuTessellation       = state.gpuTessellation;
+    mLodEnabled            = state.lodEnabled;
+    mFrustumCulling        = state.frustumCulling;
+    mIndirectDraws         = state.indirectDraws;
+    mDepthPrepass          = state.depthPrepass;
+    mDepthPrepassThreshold = state.depthPrepassThreshold;
+    mOverdrawCounter       = state.overdrawCounter;
+    mDeferredShading       = state.deferredShading;
+    mSphereImpostors       = state.sphereImpostors;
+    mGpuStatsInterval      = state.gpuStatsInterval;
+}
+
+void BloomRenderer::setScene(const SceneStore &scene)
+{
+    mScene = scene;
+
+    // One LOD state per object, so that hysteresis works per object
+    mObjectLod.fill(LodSelector(), mScene.objectCount());
+    mMovedObjects.clear();
+    mBoundsDirty = true;
+}
+
+void BloomRenderer::setObjectModel(int object, const QMatrix4x4 &model)
+{
+    mScene.setModel(object, model);
+    mMovedObjects << object;
+}
+
+void BloomRenderer::setBloomDownscale(int downscale)
+{
+    if (downscale < 1 || downscale == mBloomDownscale)
+        return;
+
+    mBloomDownscale = downscale;
+    resize(mWidth, mHeight);
+}
 
-    float deltaT = currentTimeS - tPrev;
+void BloomRenderer::setBlurSigma2(float s2)
+{
+    sigma2 = s2;
+    computeBlurWeights();
+}
+
+void BloomRenderer::render(float timeS)
+{
+    PROFILE_ZONE("render");
+    float deltaT = timeS - tPrev;
     if(tPrev == 0.0f) deltaT = 0.0f;
-    tPrev = currentTimeS;
+    tPrev = timeS;
     angle += 0.25f * deltaT;
     if (angle > TwoPI) angle -= TwoPI;
 
-    static float EvolvingVal = 0;
-    EvolvingVal += 0.1f;
-
+    glBindFramebuffer(GL_FRAMEBUFFER, mTargetFbo);
+    glViewport(0, 0, mWidth, mHeight);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 
+    QElapsedTimer passTimer;
+    passTimer.start();
+    mGpuTimer.beginFrame();
+
     pass1();
+    mPassCpuNs[Pass1] = passTimer.nsecsElapsed();
+    mGpuTimer.mark(Pass1);
+    passTimer.restart();
     aveLum = computeLogAveLuminance();
+    mPassCpuNs[PassLuminance] = passTimer.nsecsElapsed();
+    mGpuTimer.mark(PassLuminance);
     //qDebug() << "average luminance: " << aveLum;
-    pass2();
-    pass3();
-    pass4();
+    // Bright pass and blur only feed the bloom; without it pass5 just
+    // tone maps and they are skipped, their intervals stay empty
+    passTimer.restart();
+    if (mDisplayMode)
+        pass2();
+    mPassCpuNs[Pass2] = passTimer.nsecsElapsed();
+    mGpuTimer.mark(Pass2);
+    passTimer.restart();
+    if (mDisplayMode)
+        pass3();
+    mPassCpuNs[Pass3] = passTimer.nsecsElapsed();
+    mGpuTimer.mark(Pass3);
+    passTimer.restart();
+    if (mDisplayMode)
+        pass4();
+    mPassCpuNs[Pass4] = passTimer.nsecsElapsed();
+    mGpuTimer.mark(Pass4);
+    passTimer.restart();
     pass5();
+    mPassCpuNs[Pass5] = passTimer.nsecsElapsed();
+    mGpuTimer.mark(Pass5);
 
-    mContext->swapBuffers(this);
+    mGpuTimer.endFrame();
+
+    if (mGpuStatsInterval > 0 && mGpuStatsTimer.elapsed() >= mGpuStatsInterval) {
+        printGpuStats();
+        mGpuStatsTimer.restart();
+    }
 }
 
-void MyWindow::pass1()
+void BloomRenderer::printGpuStats()
+{
+    for (int i = 0; i < PassCount; i++) {
+        GpuTimer::Stats st = mGpuTimer.stats(i);
+        qDebug().nospace() << "gpu " << passName(i) << ": min " << st.minMs << " avg " << st.avgMs
+                           << " max " << st.maxMs << " ms";
+    }
+
+    GpuTimer::Stats st = mGpuTimer.frameStats();
+    qDebug().nospace() << "gpu frame: min " << st.minMs << " avg " << st.avgMs
+                       << " max " << st.maxMs << " ms (" << st.samples << " frames)";
+
+    qDebug().nospace() << "lod: " << mScene.objectCount() << " objects, " << mLodTriangles << " triangles vs " << mLodBaselineTriangles << " at fixed LOD";
+
+    qDebug().nospace() << "cull: " << mDrawnObjects << " drawn, " << mCulledObjects << " culled, "
+                       << mCullNs / 1000 << " us cpu (" << mRefitNs / 1000 << " us refit)" << (mFrustumCulling ? "" : " (off)")
+                       << ", " << mBvh.nodeCount() << " bvh nodes, " << mBvh.nodeTests() << " box tests";
+
+    qDebug().nospace() << "pass1: " << mDrawCalls << " draw calls ("
+                       << (mIndirectDraws && mPoolVao != 0 ? "multi-draw-indirect" : "direct") << "), "
+                       << stateChanges() << " state changes: " << mProgramChanges << " program, "
+                       << mVaoChanges << " vertex array, " << mMaterialChanges << " material, "
+                       << mQueue.size() << " queued, " << mQueue.passes() << " radix passes";
+
+    qDebug().nospace() << "lights: " << mLightData.size() << " point lights in " << int(ClusterX) << "x"
+                       << int(ClusterY) << "x" << int(ClusterZ) << " clusters, "
+                       << (mDeferredShading ? "deferred" : "forward") << " shading";
+
+    qDebug().nospace() << "spheres: " << impostorCount() << " impostors, " << mSphereIndices << " indices submitted";
+
+    qDebug().nospace() << "indices: " << mIndexBytes / 1024 << " KB fetched by pass1 meshes as triangle "
+                       << (mTriangleStrips ? "strips" : "lists");
+
+    if (mOverdrawCounter || mDepthPrepass == DepthPrepassAuto)
+        qDebug().nospace() << "overdraw: " << mDepthComplexity << " depth complexity, " << shadedComplexity()
+                           << " shaded per pixel, depth pre-pass " << depthPrepassName(mDepthPrepass)
+                           << (mDepthPrepassActive ? " (active)" : "");
+}
+
+void BloomRenderer::pass1()
 {   
-    glViewport(0, 0, this->width(), this->height());
+    PROFILE_ZONE("pass1");
+    mLodTriangles = mLodBaselineTriangles = 0;
+    mDrawCalls = 0;
+    glViewport(0, 0, mWidth, mHeight);
     glBindFramebuffer(GL_FRAMEBUFFER, hdrFbo);
 
     glClearColor(0.5f,0.5f,0.5f,1.0f);    
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
 
-    // *** Draw teapot
-    mFuncs->glBindVertexArray(mVAOTeapot);       
+    // Deferred: geometry goes to the G-buffer, hdrFbo keeps the clear
+    // colour until lightGBuffer()
+    int output = mDeferredShading ? OutputGBuffer : OutputShaded;
+    if (mDeferredShading) {
+        glBindFramebuffer(GL_FRAMEBUFFER, gBufferFbo);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+    cullObjects();
+    collectDrawItems(mDrawItems);
+    updateLights();
+
+    // The mesh pool goes in one indirect draw, whatever is left through
+    // the queue: the teapot patches, or everything for direct draws
+    bool indirect = mIndirectDraws && mPoolVao != 0;
+    if (indirect)
+        uploadIndirect(mDrawItems);
+    queueDrawItems(mDrawItems, !indirect);
+    uploadImpostors();
+
+    mProgramChanges = mVaoChanges = mMaterialChanges = 0;
+    bool counting = mOverdrawCounter || mDepthPrepass == DepthPrepassAuto;
+    mDepthPrepassActive = mDepthPrepass == DepthPrepassOn
+                       || (mDepthPrepass == DepthPrepassAuto && mDepthComplexity > mDepthPrepassThreshold);
+    if (counting)
+        mOverdraw.beginFrame();
+
+    // *** Depth only, the same geometry as below with invariant positions
+    if (mDepthPrepassActive) {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        mOverdraw.begin(OverdrawCounter::DepthPass);
+        drawScene(indirect, OutputDepth);
+        mOverdraw.end();
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
 
-    QVector4D worldLightl = QVector4D(0.0f-7.0f, 4.0f, 2.5f, 1.0f);
-    QVector4D worldLightm = QVector4D(0.0f, 4.0f, 2.5f, 1.0f);
-    QVector4D worldLightr = QVector4D(0.0f+7.0f, 4.0f, 2.5f, 1.0f);
-    QVector3D intense     = QVector3D(1.0f, 1.0f, 1.0f);
+    mOverdraw.begin(OverdrawCounter::ShadePass);
+    drawScene(indirect, output);
+    mOverdraw.end();
 
-    mProgram->bind();
-    {
-        mFuncs->glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &pass1Index);
+    if (mDepthPrepassActive) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
 
-        mProgram->setUniformValue("Lights[0].Position", ViewMatrix * worldLightl);
-        mProgram->setUniformValue("Lights[1].Position", ViewMatrix * worldLightm);
-        mProgram->setUniformValue("Lights[2].Position", ViewMatrix * worldLightr);
+    if (counting) {
+        mOverdraw.endFrame(qint64(mWidth) * mHeight);
+        updateDepthPrepass();
+    }
 
-        mProgram->setUniformValue("Lights[0].Intensity", intense );
-        mProgram->setUniformValue("Lights[1].Intensity", intense );
-        mProgram->setUniformValue("Lights[2].Intensity", intense );
+    if (mDeferredShading)
+        lightGBuffer();
+}
 
-        mProgram->setUniformValue("ViewNormalMatrix", ViewMatrix.normalMatrix());
+void BloomRenderer::drawScene(bool indirect, int output)
+{
+    if (indirect)
+        drawIndirect(output);
+    submitQueue(mDrawItems, output);
+    drawImpostors(output);
+}
 
-        mProgram->setUniformValue("Material.Kd", 0.4f, 0.4f, 0.9f);
-        mProgram->setUniformValue("Material.Ks", 1.0f, 1.0f, 1.0f);
-        mProgram->setUniformValue("Material.Ka", 0.2f, 0.2f, 0.2f);
-        mProgram->setUniformValue("Material.Shininess", 100.0f);
+// Eye-space spheres and materials of this frame's impostors
+void BloomRenderer::uploadImpostors()
+{
+    if (mImpostorObjects.isEmpty())
+        return;
 
-        QMatrix4x4 mv1 = ViewMatrix * ModelMatrixTeapot;
-        mProgram->setUniformValue("ModelViewMatrix", mv1);
-        mProgram->setUniformValue("NormalMatrix", mv1.normalMatrix());
-        mProgram->setUniformValue("MVP", ProjectionMatrix * mv1);
+    const QVector<int> &materials = mScene.materials();
+    const float *tx = mScene.modelElement(3), *ty = mScene.modelElement(7), *tz = mScene.modelElement(11);
+
+    mImpostorData.resize(mImpostorObjects.size());
+    for (int k = 0; k < mImpostorObjects.size(); k++) {
+        int i = mImpostorObjects[k];
+        int m = materials[i];
+        QVector3D center = ViewMatrix.map(QVector3D(tx[i], ty[i], tz[i]));
+
+        ImpostorGpu &impostor = mImpostorData[k];
+        impostor.centerRadius[0] = center.x();
+        impostor.centerRadius[1] = center.y();
+        impostor.centerRadius[2] = center.z();
+        impostor.centerRadius[3] = sphereRadius * mScene.scale(i);
+        for (int c = 0; c < 3; c++) {
+            impostor.kd[c]          = mScene.kd()[m][c];
+            impostor.ks[c]          = mScene.ks()[m][c];
+            impostor.kaShininess[c] = mScene.ka()[m][c];
+        }
+        impostor.kd[3]          = 1.0f;
+        impostor.ks[3]          = 1.0f;
+        impostor.kaShininess[3] = mScene.shininess()[m];
+    }
 
-        glDrawElements(GL_TRIANGLES, 6 * mTeapot->getnFaces(), GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mImpostorBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, mImpostorData.size() * sizeof(ImpostorGpu), mImpostorData.constData(), GL_STREAM_DRAW);
+    mFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mImpostorBuffer);
+}
 
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
-    }
-    mProgram->release();
+// One instanced strip of four vertices per sphere
+void BloomRenderer::drawImpostors(int output)
+{
+    if (mImpostorObjects.isEmpty())
+        return;
+
+    QOpenGLShaderProgram *shader = drawProgram(ProgramImpostor, output);
+    shader->bind();
+    shader->setUniformValue("ProjectionMatrix", ProjectionMatrix);
+    if (output == OutputShaded)
+        setLightUniforms(shader);
+    mProgramChanges++;
+
+    mFuncs->glBindVertexArray(mImpostorVao);
+    mVaoChanges++;
+
+    mFuncs->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, mImpostorObjects.size());
+    mDrawCalls++;
+
+    shader->release();
+}
+
+// One full-screen quad over the G-buffer into hdrTex
+void BloomRenderer::lightGBuffer()
+{
+    PROFILE_ZONE("lightGBuffer");
+    glBindFramebuffer(GL_FRAMEBUFFER, hdrFbo);
+    glDisable(GL_DEPTH_TEST);
 
-    // *** Draw planes
-    mFuncs->glBindVertexArray(mVAOPlane);
+    mFuncs->glBindVertexArray(mVAOFSQuad);
 
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
 
-    mProgram->bind();
+    mDeferredProgram->bind();
     {
-        mFuncs->glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &pass1Index);
+        setLightUniforms(mDeferredProgram);
+        mDeferredProgram->setUniformValue("InverseProjection", ProjectionMatrix.inverted());
 
-        mProgram->setUniformValue("Lights[0].Position", ViewMatrix * worldLightl);
-        mProgram->setUniformValue("Lights[1].Position", ViewMatrix * worldLightm);
-        mProgram->setUniformValue("Lights[2].Position", ViewMatrix * worldLightr);
+        QMatrix4x4 mv1 ,proj;
 
-        mProgram->setUniformValue("Lights[0].Intensity", intense );
-        mProgram->setUniformValue("Lights[1].Intensity", intense );
-        mProgram->setUniformValue("Lights[2].Intensity", intense );
+        mDeferredProgram->setUniformValue("ModelViewMatrix", mv1);
+        mDeferredProgram->setUniformValue("NormalMatrix", mv1.normalMatrix());
+        mDeferredProgram->setUniformValue("MVP", proj * mv1);
 
-        mProgram->setUniformValue("ViewNormalMatrix", ViewMatrix.normalMatrix());
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        mDrawCalls++;
 
-        mProgram->setUniformValue("Material.Kd", 0.9f, 0.3f, 0.2f);
-        mProgram->setUniformValue("Material.Ks", 1.0f, 1.0f, 1.0f);
-        mProgram->setUniformValue("Material.Ka", 0.2f, 0.2f, 0.2f);
-        mProgram->setUniformValue("Material.Shininess", 100.0f);
+        glDisableVertexAttribArray(0);
+        glDisableVertexAttribArray(1);
+        glDisableVertexAttribArray(2);
+    }
+    mDeferredProgram->release();
 
-        // back plane
-        QMatrix4x4 mvback = ViewMatrix * ModelMatrixBackPlane;
-        mProgram->setUniformValue("ModelViewMatrix", mvback);
-        mProgram->setUniformValue("NormalMatrix", mvback.normalMatrix());
-        mProgram->setUniformValue("MVP", ProjectionMatrix * mvback);
-        glDrawElements(GL_TRIANGLES, 6 * mPlane->getnFaces(), GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glEnable(GL_DEPTH_TEST);
+}
 
-        // Top plane
-        QMatrix4x4 mvtop = ViewMatrix * ModelMatrixTopPlane;
-        mProgram->setUniformValue("ModelViewMatrix", mvtop);
-        mProgram->setUniformValue("NormalMatrix", mvtop.normalMatrix());
-        mProgram->setUniformValue("MVP", ProjectionMatrix * mvtop);
-        glDrawElements(GL_TRIANGLES, 6 * mPlane->getnFaces(), GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+// Latest finished overdraw count: with the pre-pass on, its samples are
+// what lighting alone would have shaded
+void BloomRenderer::updateDepthPrepass()
+{
+    if (!mOverdraw.collect())
+        return;
 
-        // Bot plane
-        QMatrix4x4 mvbot = ViewMatrix * ModelMatrixBotPlane;
-        mProgram->setUniformValue("ModelViewMatrix", mvbot);
-        mProgram->setUniformValue("NormalMatrix", mvbot.normalMatrix());
-        mProgram->setUniformValue("MVP", ProjectionMatrix * mvbot);
+    float depthPass = mOverdraw.complexity(OverdrawCounter::DepthPass);
+    mDepthComplexity = depthPass > 0.0f ? depthPass : mOverdraw.complexity(OverdrawCounter::ShadePass);
+}
 
-        glDrawElements(GL_TRIANGLES, 6 * mPlane->getnFaces(), GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+// World-space boxes of the scene objects and the BVH over them: rebuilt
+// for a new scene, refit where objects moved
+void BloomRenderer::updateBounds()
+{
+    if (!mBoundsDirty && mMovedObjects.isEmpty())
+        return;
 
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
+    const QVector<quint8> &meshes = mScene.meshes();
+
+    // Object-space boxes per mesh; a LOD chain's box covers all its levels
+    const QVector3D *mins[SceneStore::MeshCount] = { &mTeapotLod.boundsMin, &mSphereLod.boundsMin, &mPlaneMesh.boundsMin };
+    const QVector3D *maxs[SceneStore::MeshCount] = { &mTeapotLod.boundsMax, &mSphereLod.boundsMax, &mPlaneMesh.boundsMax };
+    float localMin[SceneStore::MeshCount][3], localMax[SceneStore::MeshCount][3];
+    for (int m = 0; m < SceneStore::MeshCount; m++)
+        for (int c = 0; c < 3; c++) {
+            localMin[m][c] = (*mins[m])[c];
+            localMax[m][c] = (*maxs[m])[c];
+        }
+
+    if (mBoundsDirty) {
+        mWorldBounds.resize(meshes.size());
+        for (int i = 0; i < meshes.size(); i++)
+            mWorldBounds[i] = Aabb::transformed(localMin[meshes[i]], localMax[meshes[i]], mScene.model(i));
+        mBvh.build(mWorldBounds);
+        mBoundsDirty = false;
+    } else {
+        for (int k = 0; k < mMovedObjects.size(); k++) {
+            int i = mMovedObjects[k];
+            mWorldBounds[i] = Aabb::transformed(localMin[meshes[i]], localMax[meshes[i]], mScene.model(i));
+        }
+        mBvh.refit(mWorldBounds, mMovedObjects);
     }
-    mProgram->release();
+    mMovedObjects.clear();
+}
 
-    // *** Draw sphere
-    mFuncs->glBindVertexArray(mVAOSphere);
+BvhComparison BloomRenderer::compareBvhRebuild()
+{
+    BvhComparison result;
+    Frustum frustum(ProjectionMatrix * ViewMatrix);
+    QVector<int> visible;
+
+    updateBounds();
+    mBvh.cull(frustum, mWorldBounds, visible);
+    result.refitCost  = mBvh.cost();
+    result.refitTests = mBvh.nodeTests();
+
+    Bvh rebuilt;
+    QElapsedTimer timer;
+    timer.start();
+    rebuilt.build(mWorldBounds);
+    result.rebuildNs = timer.nsecsElapsed();
+
+    visible.clear();
+    rebuilt.cull(frustum, mWorldBounds, visible);
+    result.rebuildCost  = rebuilt.cost();
+    result.rebuildTests = rebuilt.nodeTests();
+
+    return result;
+}
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+void BloomRenderer::cullObjects()
+{
+    PROFILE_ZONE("cullObjects");
+    QElapsedTimer timer;
+    timer.start();
+
+    mVisibleObjects.clear();
+    mRefitNs = 0;
+    if (mFrustumCulling) {
+        QElapsedTimer refitTimer;
+        refitTimer.start();
+        updateBounds();
+        mRefitNs = refitTimer.nsecsElapsed();
+
+        mBvh.cull(Frustum(ProjectionMatrix * ViewMatrix), mWorldBounds, mVisibleObjects);
+        // Back in scene order, which keeps materials and meshes together
+        std::sort(mVisibleObjects.begin(), mVisibleObjects.end());
+    } else {
+        mVisibleObjects.resize(mScene.objectCount());
+        for (int i = 0; i < mVisibleObjects.size(); i++)
+            mVisibleObjects[i] = i;
+
+        // Nothing refits while off; rebuild once culling is back on
+        // rather than keep every move of the meantime
+        if (!mMovedObjects.isEmpty()) {
+            mMovedObjects.clear();
+            mBoundsDirty = true;
+        }
+    }
 
-    mProgram->bind();
-    {
-        mFuncs->glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &pass1Index);
+    mDrawnObjects  = mVisibleObjects.size();
+    mCulledObjects = mScene.objectCount() - mDrawnObjects;
+    mCullNs = timer.nsecsElapsed();
+}
+
+void BloomRenderer::collectDrawItems(QVector<DrawItem> &items)
+{
+    items.clear();
+    mImpostorObjects.clear();
+    mSphereIndices = 0;
+    mIndexBytes = 0;
+
+    const QVector<quint8> &meshes    = mScene.meshes();
+    const QVector<int>    &materials = mScene.materials();
+    const float *tx = mScene.modelElement(3), *ty = mScene.modelElement(7), *tz = mScene.modelElement(11);
+
+    for (int k = 0; k < mVisibleObjects.size(); k++) {
+        int i = mVisibleObjects[k];
+
+        DrawItem item;
+        item.object   = i;
+        item.material = materials[i];
+        item.program  = ProgramMesh;
+        item.depth    = -(ViewMatrix(2, 0) * tx[i] + ViewMatrix(2, 1) * ty[i] + ViewMatrix(2, 2) * tz[i]
+                          + ViewMatrix(2, 3));
+
+        // Teapots are tessellated on the GPU by the patch program instead
+        if (meshes[i] == SceneStore::MeshTeapot && mGpuTessellation) {
+            item.mesh    = 0;
+            item.meshId  = -1;
+            item.program = ProgramTess;
+            items << item;
+            continue;
+        }
+
+        // Sphere impostors are drawn apart from the queue, all at once
+        if (meshes[i] == SceneStore::MeshSphere && mSphereImpostors) {
+            mImpostorObjects << i;
+            mSphereIndices += 4;
+            continue;
+        }
 
-        mProgram->setUniformValue("Lights[0].Position", ViewMatrix * worldLightl );
-        mProgram->setUniformValue("Lights[1].Position", ViewMatrix * worldLightm );
-        mProgram->setUniformValue("Lights[2].Position", ViewMatrix * worldLightr);
+        switch (meshes[i]) {
+        case SceneStore::MeshTeapot:
+            item.meshId = selectLod(mTeapotLod, i);
+            item.mesh   = &mTeapotLod.levels.at(item.meshId);
+            break;
+        case SceneStore::MeshSphere:
+            item.meshId = selectLod(mSphereLod, i);
+            item.mesh   = &mSphereLod.levels.at(item.meshId);
+            item.meshId += LodLevels;
+            mSphereIndices += item.mesh->indexCount;
+            break;
+        default:
+            item.mesh   = &mPlaneMesh;
+            item.meshId = 2 * LodLevels;
+            break;
+        }
+        mIndexBytes += qint64(item.mesh->indexCount) * (item.mesh->indexType == GL_UNSIGNED_SHORT ? 2 : 4);
+        items << item;
+    }
+}
+
+// Light positions move to view space once per frame, then the cluster
+// pass bins them for every program that lights pass1
+void BloomRenderer::updateLights()
+{
+    PROFILE_ZONE("updateLights");
+    const QVector<QVector4D> &positions   = mScene.lightPositions();
+    const QVector<QVector3D> &intensities = mScene.lightIntensities();
+    const QVector<float>     &radii       = mScene.lightRadii();
+    int count = positions.size();
+
+    mLightData.resize(count);
+    for (int i = 0; i < count; i++) {
+        QVector4D p = ViewMatrix * positions[i];
+        LightGpu &light = mLightData[i];
+        light.position[0]  = p.x();
+        light.position[1]  = p.y();
+        light.position[2]  = p.z();
+        light.position[3]  = radii[i];
+        light.intensity[0] = intensities[i].x();
+        light.intensity[1] = intensities[i].y();
+        light.intensity[2] = intensities[i].z();
+        light.intensity[3] = 0.0f;
+    }
 
-        mProgram->setUniformValue("Lights[0].Intensity", intense );
-        mProgram->setUniformValue("Lights[1].Intensity", intense );
-        mProgram->setUniformValue("Lights[2].Intensity", intense );
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightBuffer);
+    // Never a zero-sized store; with no lights an empty QVector has nothing
+    // to read, so the one placeholder light is left uninitialised
+    glBufferData(GL_SHADER_STORAGE_BUFFER, qMax(1, count) * sizeof(LightGpu),
+                 count > 0 ? mLightData.constData() : 0, GL_STREAM_DRAW);
+    mFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mLightBuffer);
+    mFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mClusterCountBuffer);
+    mFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mClusterLightBuffer);
+
+    // Near and far planes of the perspective projection; slices are
+    // exponential in depth, slice = log(depth / near) / log(far / near) * ClusterZ
+    float p22 = ProjectionMatrix(2, 2), p23 = ProjectionMatrix(2, 3);
+    float zNear = p23 / (p22 - 1.0f), zFar = p23 / (p22 + 1.0f);
+    mClusterSliceScale = ClusterZ / std::log(zFar / zNear);
+    mClusterSliceBias  = -ClusterZ * std::log(zNear) / std::log(zFar / zNear);
+
+    mClusterProgram->bind();
+    mClusterProgram->setUniformValue("NumLights", count);
+    mClusterProgram->setUniformValue("InverseProjection", ProjectionMatrix.inverted());
+    mClusterProgram->setUniformValue("ClusterNear", zNear);
+    mClusterProgram->setUniformValue("ClusterFar", zFar);
+    mFuncs->glDispatchCompute((ClusterCount + 63) / 64, 1, 1);
+    mClusterProgram->release();
+
+    mFuncs->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
 
-        mProgram->setUniformValue("ViewNormalMatrix", ViewMatrix.normalMatrix());
+void BloomRenderer::setLightUniforms(QOpenGLShaderProgram *program)
+{
+    program->setUniformValue("ClusterTileSize", QVector2D(float(mWidth) / ClusterX, float(mHeight) / ClusterY));
+    program->setUniformValue("ClusterSliceScale", mClusterSliceScale);
+    program->setUniformValue("ClusterSliceBias", mClusterSliceBias);
 
-        mProgram->setUniformValue("Material.Kd", 0.4f, 0.9f, 0.4f);
-        mProgram->setUniformValue("Material.Ks", 1.0f, 1.0f, 1.0f);
-        mProgram->setUniformValue("Material.Ka", 0.2f, 0.2f, 0.2f);
-        mProgram->setUniformValue("Material.Shininess", 100.0f);
+    program->setUniformValue("ViewNormalMatrix", ViewMatrix.normalMatrix());
+}
 
-        QMatrix4x4 mv1 = ViewMatrix * ModelMatrixSphere;
-        mProgram->setUniformValue("ModelViewMatrix", mv1);
-        mProgram->setUniformValue("NormalMatrix", mv1.normalMatrix());
-        mProgram->setUniformValue("MVP", ProjectionMatrix * mv1);                
+void BloomRenderer::setMaterialUniforms(QOpenGLShaderProgram *program, int material)
+{
+    program->setUniformValue("Material.Ka", mScene.ka()[material]);
+    program->setUniformValue("Material.Kd", mScene.kd()[material]);
+    program->setUniformValue("Material.Ks", mScene.ks()[material]);
+    program->setUniformValue("Material.Shininess", mScene.shininess()[material]);
+}
 
-        glDrawElements(GL_TRIANGLES, mSphere->getnFaces(), GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+// Matrices of one object from its TransformBatch output; the program is bound
+void BloomRenderer::setObjectUniforms(const ObjectUniforms &uniforms, const ObjectGpu &object)
+{
+    float normal[9];
+    for (int c = 0; c < 3; c++)
+        for (int r = 0; r < 3; r++)
+            normal[3*c + r] = object.normalMatrix[4*c + r];
+
+    mFuncs->glUniformMatrix4fv(uniforms.modelView, 1, GL_FALSE, object.modelView);
+    mFuncs->glUniformMatrix3fv(uniforms.normalMatrix, 1, GL_FALSE, normal);
+    mFuncs->glUniformMatrix4fv(uniforms.mvp, 1, GL_FALSE, object.mvp);
+}
 
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
+void BloomRenderer::drawMesh(const MeshBuffers &mesh)
+{
+    GLsizeiptr offset = GLsizeiptr(mesh.firstIndex) * (mesh.indexType == GL_UNSIGNED_SHORT ? 2 : 4);
+    mFuncs->glDrawElementsBaseVertex(mesh.mode, mesh.indexCount, mesh.indexType,
+                                     ((GLubyte *)NULL + offset), mesh.baseVertex);
+    mDrawCalls++;
+}
+
+// Queues the patch draws, and the mesh draws too unless meshes is false.
+// Depth buckets span the nearest to the farthest queued object.
+void BloomRenderer::queueDrawItems(const QVector<DrawItem> &items, bool meshes)
+{
+    mQueue.clear();
+
+    float maxDepth = 0.0f;
+    for (int i = 0; i < items.size(); i++)
+        if (meshes || items[i].mesh == 0)
+            maxDepth = qMax(maxDepth, items[i].depth);
+
+    for (int i = 0; i < items.size(); i++) {
+        const DrawItem &item = items[i];
+        if (!meshes && item.mesh != 0)
+            continue;
+
+        GLuint vao = item.mesh != 0 ? item.mesh->vao : mVAOTeapotPatches;
+        mQueue.push(RenderQueue::makeKey(item.program, vao, item.material,
+                                         RenderQueue::depthBucket(item.depth, maxDepth)), i);
+    }
+    mQueue.sort();
+
+    // All matrices in one sweep, in submission order
+    mDrawOrder.resize(mQueue.size());
+    for (int k = 0; k < mQueue.size(); k++)
+        mDrawOrder[k] = items[mQueue.at(k).item].object;
+    mObjectData.resize(mDrawOrder.size());
+    TransformBatch(ViewMatrix, ProjectionMatrix).compute(mScene, mDrawOrder.constData(), mDrawOrder.size(),
+                                                         mObjectData.data());
+}
+
+QOpenGLShaderProgram *BloomRenderer::drawProgram(int program, int output) const
+{
+    if (program == ProgramImpostor) {
+        switch (output) {
+        case OutputDepth:   return mImpostorDepthProgram;
+        case OutputGBuffer: return mImpostorGBufferProgram;
+        default:            return mImpostorProgram;
+        }
+    }
+
+    bool tess = program == ProgramTess;
+    switch (output) {
+    case OutputDepth:   return tess ? mTessDepthProgram : mDepthProgram;
+    case OutputGBuffer: return tess ? mTessGBufferProgram : mGBufferProgram;
+    default:            return tess ? mTessProgram : mProgram;
+    }
+}
+
+const BloomRenderer::ObjectUniforms &BloomRenderer::drawUniforms(int program, int output) const
+{
+    bool tess = program == ProgramTess;
+    switch (output) {
+    case OutputDepth:   return tess ? mTessDepthObjectUniforms : mDepthObjectUniforms;
+    case OutputGBuffer: return tess ? mTessGBufferObjectUniforms : mGBufferObjectUniforms;
+    default:            return tess ? mTessObjectUniforms : mObjectUniforms;
+    }
+}
+
+void BloomRenderer::bindDrawProgram(int program, int output)
+{
+    QOpenGLShaderProgram *shader = drawProgram(program, output);
+    shader->bind();
+
+    if (output == OutputShaded) {
+        GLuint *index = program == ProgramTess ? &tessPass1Index : &pass1Index;
+        mFuncs->glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, index);
+        setLightUniforms(shader);
+    }
+
+    // The tessellation levels must match between both passes
+    if (program == ProgramTess) {
+        shader->setUniformValue("Viewport", QVector2D(mWidth, mHeight));
+        shader->setUniformValue("TessPixelsPerSegment", mTessPixelsPerSegment);
+        mFuncs->glPatchParameteri(GL_PATCH_VERTICES, 16);
     }
-    mProgram->release();
 }
 
-void MyWindow::pass2()
+// Draws the sorted queue, switching program, vertex array and material
+// only where the key changes them. The depth-only programs skip lights
+// and materials, the G-buffer programs lights.
+void BloomRenderer::submitQueue(const QVector<DrawItem> &items, int output)
+{
+    if (mQueue.size() == 0)
+        return;
+
+    int    program  = -1;
+    GLuint vao      = 0;
+    int    material = -1;
+    for (int k = 0; k < mQueue.size(); k++) {
+        const DrawItem &item = items[mQueue.at(k).item];
+
+        if (item.program != program) {
+            program  = item.program;
+            material = -1;
+            bindDrawProgram(program, output);
+            mProgramChanges++;
+        }
+
+        GLuint itemVao = item.mesh != 0 ? item.mesh->vao : mVAOTeapotPatches;
+        if (itemVao != vao) {
+            vao = itemVao;
+            mFuncs->glBindVertexArray(vao);
+            glEnableVertexAttribArray(0);
+            if (item.mesh != 0)
+                glEnableVertexAttribArray(1);
+            mVaoChanges++;
+        }
+
+        if (output != OutputDepth && item.material != material) {
+            material = item.material;
+            setMaterialUniforms(drawProgram(program, output), material);
+            mMaterialChanges++;
+        }
+        setObjectUniforms(drawUniforms(item.program, output), mObjectData[k]);
+
+        if (item.mesh != 0) {
+            drawMesh(*item.mesh);
+        } else {
+            glDrawArrays(GL_PATCHES, 0, mTeapotPatchVerts);
+            mDrawCalls++;
+        }
+    }
+    drawProgram(program, output)->release();
+}
+
+// Builds the commands and Objects buffer of the mesh pool draw
+void BloomRenderer::uploadIndirect(const QVector<DrawItem> &items)
+{
+    // Objects sharing a mesh go next to each other and become the instances
+    // of one command; their slot in the Objects buffer is the instance index.
+    // A counting sort over the few mesh ids keeps this linear in the objects.
+    int counts[MeshIds], starts[MeshIds];
+    const MeshBuffers *meshes[MeshIds];
+    for (int m = 0; m < MeshIds; m++) {
+        counts[m] = 0;
+        meshes[m] = 0;
+    }
+    for (int i = 0; i < items.size(); i++) {
+        if (items[i].mesh == 0)
+            continue;
+        counts[items[i].meshId]++;
+        meshes[items[i].meshId] = items[i].mesh;
+    }
+
+    mCommands.clear();
+    int slot = 0;
+    for (int m = 0; m < MeshIds; m++) {
+        starts[m] = slot;
+        if (counts[m] == 0)
+            continue;
+
+        DrawCommand command;
+        command.count         = meshes[m]->indexCount;
+        command.instanceCount = counts[m];
+        command.firstIndex    = meshes[m]->firstIndex;
+        command.baseVertex    = meshes[m]->baseVertex;
+        command.baseInstance  = slot;
+        mCommands << command;
+        slot += counts[m];
+    }
+
+    mDrawOrder.resize(slot);
+    for (int i = 0; i < items.size(); i++)
+        if (items[i].mesh != 0)
+            mDrawOrder[starts[items[i].meshId]++] = items[i].object;
+    if (mCommands.isEmpty())
+        return;
+
+    reserveObjects(mDrawOrder.size());
+
+    // The transforms are written straight into the orphaned buffer
+    GLsizeiptr objectBytes = GLsizeiptr(mDrawOrder.size()) * sizeof(ObjectGpu);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mObjectBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, objectBytes, NULL, GL_STREAM_DRAW);
+    void *objects = mFuncs->glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, objectBytes,
+                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (objects != 0) {
+        TransformBatch(ViewMatrix, ProjectionMatrix).compute(mScene, mDrawOrder.constData(), mDrawOrder.size(),
+                                                             static_cast<ObjectGpu *>(objects));
+        mFuncs->glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    } else {
+        qWarning() << "cannot map the Objects buffer";
+    }
+    mFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mObjectBuffer);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mIndirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, mCommands.size() * sizeof(DrawCommand), mCommands.constData(), GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void BloomRenderer::drawIndirect(int output)
+{
+    if (mCommands.isEmpty())
+        return;
+
+    mFuncs->glBindVertexArray(mPoolVao);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mIndirectBuffer);
+
+    bindDrawProgram(ProgramMesh, output);
+    mProgramChanges++;
+    mVaoChanges++;
+    {
+        QOpenGLShaderProgram *shader = drawProgram(ProgramMesh, output);
+        shader->setUniformValue("UseObjects", true);
+
+        mFuncs->glMultiDrawElementsIndirect(mPoolMode, mPoolIndexType, 0, mCommands.size(), 0);
+        mDrawCalls++;
+
+        shader->setUniformValue("UseObjects", false);
+        shader->release();
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void BloomRenderer::pass2()
 {    
+    PROFILE_ZONE("pass2");
 
     glBindFramebuffer(GL_FRAMEBUFFER, blurFbo);
 
@@ -516,8 +1558,9 @@ void MyWindow::pass2()
     mProgram->release();
 }
 
-void MyWindow::pass3()
+void BloomRenderer::pass3()
 {
+    PROFILE_ZONE("pass3");
     // We're writing to tex2 this time
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex2, 0);
 
@@ -553,8 +1596,9 @@ void MyWindow::pass3()
     mProgram->release();
 }
 
-void MyWindow::pass4()
+void BloomRenderer::pass4()
 {
+    PROFILE_ZONE("pass4");
 
     // We're writing to tex1 this time
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex1, 0);
@@ -592,13 +1636,14 @@ void MyWindow::pass4()
 }
 
 
-void MyWindow::pass5()
+void BloomRenderer::pass5()
 {
-    glBindFramebuffer(GL_FRAMEBUFFER,0);
+    PROFILE_ZONE("pass5");
+    glBindFramebuffer(GL_FRAMEBUFFER, mTargetFbo);
 
     //glClearColor(0,0,0,0);
     glClear(GL_COLOR_BUFFER_BIT);
-    glViewport(0, 0, this->width(), this->height());
+    glViewport(0, 0, mWidth, mHeight);
 
     // In this pass, we're reading from tex1 (unit 1) and we want
     // linear sampling to get an extra blur
@@ -615,7 +1660,7 @@ void MyWindow::pass5()
         mFuncs->glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &pass5Index);
 
         mProgram->setUniformValue( "AveLum",    aveLum );
-        mProgram->setUniformValue( "DoToneMap", displayMode );
+        mProgram->setUniformValue( "DoToneMap", mDisplayMode );
 
         QMatrix4x4 mv1 ,proj;
 
@@ -636,8 +1681,22 @@ void MyWindow::pass5()
     mFuncs->glBindSampler(1, nearestSampler);
 }
 
-void MyWindow::initShaders()
+// Source of a shader using ads(): the defines and lighting.txt go right
+// after its #version line, #line keeps the compiler messages on its lines
+static QByteArray litShaderSource(const QString &fileName, const QByteArray &defines = QByteArray())
 {
+    QFile shaderFile(fileName), lightingFile(":/lighting.txt");
+    shaderFile.open(QIODevice::ReadOnly);
+    lightingFile.open(QIODevice::ReadOnly);
+    QByteArray source = shaderFile.readAll();
+
+    int body = source.indexOf('\n') + 1;
+    return source.left(body) + defines + lightingFile.readAll() + "\n#line 2\n" + source.mid(body);
+}
+
+void BloomRenderer::initShaders()
+{
+    PROFILE_ZONE("initShaders");
     QOpenGLShader vShader(QOpenGLShader::Vertex);
     QOpenGLShader fShader(QOpenGLShader::Fragment);    
     QFile         shaderFile;
@@ -650,19 +1709,167 @@ void MyWindow::initShaders()
     shaderFile.close();
     qDebug() << "vertex compile: " << vShader.compileSourceCode(shaderSource);
 
-    shaderFile.setFileName(":/fshader.txt");
-    shaderFile.open(QIODevice::ReadOnly);
-    shaderSource = shaderFile.readAll();
-    shaderFile.close();
-    qDebug() << "frag   compile: " << fShader.compileSourceCode(shaderSource);
+    qDebug() << "frag   compile: " << fShader.compileSourceCode(litShaderSource(":/fshader.txt"));
 
     mProgram = new (QOpenGLShaderProgram);
     mProgram->addShader(&vShader);
     mProgram->addShader(&fShader);
     qDebug() << "shader link: " << mProgram->link();
+
+    mObjectUniforms.modelView    = mProgram->uniformLocation("ModelViewMatrix");
+    mObjectUniforms.normalMatrix = mProgram->uniformLocation("NormalMatrix");
+    mObjectUniforms.mvp          = mProgram->uniformLocation("MVP");
+
+    // Depth pre-pass: the same vertex shader, gl_Position is invariant
+    QOpenGLShader depthShader(QOpenGLShader::Fragment);
+    qDebug() << "depth  compile: " << depthShader.compileSourceFile(":/depthfshader.txt");
+
+    mDepthProgram = new (QOpenGLShaderProgram);
+    mDepthProgram->addShader(&vShader);
+    mDepthProgram->addShader(&depthShader);
+    qDebug() << "depth shader link: " << mDepthProgram->link();
+
+    mDepthObjectUniforms.modelView    = mDepthProgram->uniformLocation("ModelViewMatrix");
+    mDepthObjectUniforms.normalMatrix = mDepthProgram->uniformLocation("NormalMatrix");
+    mDepthObjectUniforms.mvp          = mDepthProgram->uniformLocation("MVP");
+}
+
+void BloomRenderer::initTessShaders()
+{
+    PROFILE_ZONE("initTessShaders");
+    QOpenGLShader vShader(QOpenGLShader::Vertex);
+    QOpenGLShader tcShader(QOpenGLShader::TessellationControl);
+    QOpenGLShader teShader(QOpenGLShader::TessellationEvaluation);
+    QOpenGLShader fShader(QOpenGLShader::Fragment);
+
+    qDebug() << "tess vertex compile: " << vShader.compileSourceFile(":/tessvshader.txt");
+    qDebug() << "tess ctrl   compile: " << tcShader.compileSourceFile(":/tcshader.txt");
+    qDebug() << "tess eval   compile: " << teShader.compileSourceFile(":/teshader.txt");
+    qDebug() << "tess frag   compile: " << fShader.compileSourceCode(litShaderSource(":/fshader.txt"));
+
+    mTessProgram = new (QOpenGLShaderProgram);
+    mTessProgram->addShader(&vShader);
+    mTessProgram->addShader(&tcShader);
+    mTessProgram->addShader(&teShader);
+    mTessProgram->addShader(&fShader);
+    qDebug() << "tess shader link: " << mTessProgram->link();
+
+    mTessObjectUniforms.modelView    = mTessProgram->uniformLocation("ModelViewMatrix");
+    mTessObjectUniforms.normalMatrix = mTessProgram->uniformLocation("NormalMatrix");
+    mTessObjectUniforms.mvp          = mTessProgram->uniformLocation("MVP");
+
+    QOpenGLShader depthShader(QOpenGLShader::Fragment);
+    qDebug() << "tess depth  compile: " << depthShader.compileSourceFile(":/depthfshader.txt");
+
+    mTessDepthProgram = new (QOpenGLShaderProgram);
+    mTessDepthProgram->addShader(&vShader);
+    mTessDepthProgram->addShader(&tcShader);
+    mTessDepthProgram->addShader(&teShader);
+    mTessDepthProgram->addShader(&depthShader);
+    qDebug() << "tess depth shader link: " << mTessDepthProgram->link();
+
+    mTessDepthObjectUniforms.modelView    = mTessDepthProgram->uniformLocation("ModelViewMatrix");
+    mTessDepthObjectUniforms.normalMatrix = mTessDepthProgram->uniformLocation("NormalMatrix");
+    mTessDepthObjectUniforms.mvp          = mTessDepthProgram->uniformLocation("MVP");
+
+    tessPass1Index = mFuncs->glGetSubroutineIndex( mTessProgram->programId(), GL_FRAGMENT_SHADER, "pass1");
+}
+
+void BloomRenderer::initDeferredShaders()
+{
+    PROFILE_ZONE("initDeferredShaders");
+    QOpenGLShader vShader(QOpenGLShader::Vertex);
+    QOpenGLShader tessVShader(QOpenGLShader::Vertex);
+    QOpenGLShader tcShader(QOpenGLShader::TessellationControl);
+    QOpenGLShader teShader(QOpenGLShader::TessellationEvaluation);
+    QOpenGLShader gBufferShader(QOpenGLShader::Fragment);
+    QOpenGLShader lightShader(QOpenGLShader::Fragment);
+
+    qDebug() << "gbuffer vertex compile: " << vShader.compileSourceFile(":/vshader.txt");
+    qDebug() << "gbuffer tess vertex compile: " << tessVShader.compileSourceFile(":/tessvshader.txt");
+    qDebug() << "gbuffer tess ctrl   compile: " << tcShader.compileSourceFile(":/tcshader.txt");
+    qDebug() << "gbuffer tess eval   compile: " << teShader.compileSourceFile(":/teshader.txt");
+    qDebug() << "gbuffer frag   compile: " << gBufferShader.compileSourceFile(":/gbufferfshader.txt");
+    qDebug() << "deferred frag  compile: " << lightShader.compileSourceCode(litShaderSource(":/deferredfshader.txt"));
+
+    mGBufferProgram = new (QOpenGLShaderProgram);
+    mGBufferProgram->addShader(&vShader);
+    mGBufferProgram->addShader(&gBufferShader);
+    qDebug() << "gbuffer shader link: " << mGBufferProgram->link();
+
+    mGBufferObjectUniforms.modelView    = mGBufferProgram->uniformLocation("ModelViewMatrix");
+    mGBufferObjectUniforms.normalMatrix = mGBufferProgram->uniformLocation("NormalMatrix");
+    mGBufferObjectUniforms.mvp          = mGBufferProgram->uniformLocation("MVP");
+
+    mTessGBufferProgram = new (QOpenGLShaderProgram);
+    mTessGBufferProgram->addShader(&tessVShader);
+    mTessGBufferProgram->addShader(&tcShader);
+    mTessGBufferProgram->addShader(&teShader);
+    mTessGBufferProgram->addShader(&gBufferShader);
+    qDebug() << "tess gbuffer shader link: " << mTessGBufferProgram->link();
+
+    mTessGBufferObjectUniforms.modelView    = mTessGBufferProgram->uniformLocation("ModelViewMatrix");
+    mTessGBufferObjectUniforms.normalMatrix = mTessGBufferProgram->uniformLocation("NormalMatrix");
+    mTessGBufferObjectUniforms.mvp          = mTessGBufferProgram->uniformLocation("MVP");
+
+    // The full-screen quad goes through vshader.txt like pass2 to pass5
+    mDeferredProgram = new (QOpenGLShaderProgram);
+    mDeferredProgram->addShader(&vShader);
+    mDeferredProgram->addShader(&lightShader);
+    qDebug() << "deferred shader link: " << mDeferredProgram->link();
+}
+
+void BloomRenderer::initImpostorShaders()
+{
+    PROFILE_ZONE("initImpostorShaders");
+    QOpenGLShader vShader(QOpenGLShader::Vertex);
+    QOpenGLShader fShader(QOpenGLShader::Fragment);
+    QOpenGLShader depthShader(QOpenGLShader::Fragment);
+    QOpenGLShader gBufferShader(QOpenGLShader::Fragment);
+
+    qDebug() << "impostor vertex compile: " << vShader.compileSourceFile(":/impostorvshader.txt");
+    qDebug() << "impostor frag   compile: " << fShader.compileSourceCode(litShaderSource(":/impostorfshader.txt"));
+    qDebug() << "impostor depth  compile: "
+             << depthShader.compileSourceCode(litShaderSource(":/impostorfshader.txt", "#define IMPOSTOR_DEPTH\n"));
+    qDebug() << "impostor gbuffer compile: "
+             << gBufferShader.compileSourceCode(litShaderSource(":/impostorfshader.txt", "#define IMPOSTOR_GBUFFER\n"));
+
+    QOpenGLShader *fragments[] = { &fShader, &depthShader, &gBufferShader };
+    QOpenGLShaderProgram **programs[] = { &mImpostorProgram, &mImpostorDepthProgram, &mImpostorGBufferProgram };
+    for (int i = 0; i < 3; i++) {
+        *programs[i] = new (QOpenGLShaderProgram);
+        (*programs[i])->addShader(&vShader);
+        (*programs[i])->addShader(fragments[i]);
+        qDebug() << "impostor shader link: " << (*programs[i])->link();
+    }
+
+    // Every vertex comes from gl_VertexID, but core profile draws need a VAO
+    glGenBuffers(1, &mImpostorBuffer);
+    mFuncs->glGenVertexArrays(1, &mImpostorVao);
 }
 
-void MyWindow::PrepareTexture(GLenum TextureTarget, const QString& FileName, GLuint& TexObject, bool flip)
+void BloomRenderer::initClusterShader()
+{
+    PROFILE_ZONE("initClusterShader");
+    QOpenGLShader cShader(QOpenGLShader::Compute);
+    qDebug() << "cluster compile: " << cShader.compileSourceFile(":/clustercshader.txt");
+
+    mClusterProgram = new (QOpenGLShaderProgram);
+    mClusterProgram->addShader(&cShader);
+    qDebug() << "cluster shader link: " << mClusterProgram->link();
+
+    // Fixed size, ClusterMaxLights slots per cluster
+    glGenBuffers(1, &mLightBuffer);
+    glGenBuffers(1, &mClusterCountBuffer);
+    glGenBuffers(1, &mClusterLightBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mClusterCountBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, ClusterCount * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mClusterLightBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, ClusterCount * ClusterMaxLights * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void BloomRenderer::PrepareTexture(GLenum TextureTarget, const QString& FileName, GLuint& TexObject, bool flip)
 {
     QImage TexImg;
 
@@ -676,47 +1883,7 @@ void MyWindow::PrepareTexture(GLenum TextureTarget, const QString& FileName, GLu
     glTexParameterf(TextureTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
-void MyWindow::keyPressEvent(QKeyEvent *keyEvent)
-{
-    switch(keyEvent->key())
-    {
-        case Qt::Key_P:
-            break;
-        case Qt::Key_O:
-            displayMode = !displayMode;
-            break;
-        case Qt::Key_Up:
-            break;
-        case Qt::Key_Down:
-            break;
-        case Qt::Key_Left:
-            break;
-        case Qt::Key_Right:
-            break;
-        case Qt::Key_Delete:
-            break;
-        case Qt::Key_PageDown:
-            break;
-        case Qt::Key_Home:
-            break;
-        case Qt::Key_Z:
-            break;
-        case Qt::Key_Q:
-            break;
-        case Qt::Key_S:
-            break;
-        case Qt::Key_D:
-            break;
-        case Qt::Key_A:
-            break;
-        case Qt::Key_E:
-            break;
-        default:
-            break;
-    }
-}
-
-void MyWindow::printMatrix(const QMatrix4x4& mat)
+void BloomRenderer::printMatrix(const QMatrix4x4& mat)
 {
     const float *locMat = mat.transposed().constData();
 
@@ -726,7 +1893,7 @@ void MyWindow::printMatrix(const QMatrix4x4& mat)
     }
 }
 
-void MyWindow::setupFBO() {
+void BloomRenderer::setupFBO() {
     // Generate and bind the framebuffer
     glGenFramebuffers(1, &hdrFbo);
     glBindFramebuffer(GL_FRAMEBUFFER, hdrFbo);
@@ -735,20 +1902,19 @@ void MyWindow::setupFBO() {
     glGenTextures(1, &hdrTex);
     glActiveTexture(GL_TEXTURE0);  // Use texture unit 0
     glBindTexture(GL_TEXTURE_2D, hdrTex);
-    mFuncs->glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB32F, this->width(), this->height());
+    mFuncs->glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB32F, mWidth, mHeight);
 
     // Bind the texture to the FBO
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hdrTex, 0);
 
     // Create the depth buffer
-    GLuint depthBuf;
-    glGenRenderbuffers(1, &depthBuf);
-    glBindRenderbuffer(GL_RENDERBUFFER, depthBuf);
-    mFuncs->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, this->width(), this->height());
+    glGenRenderbuffers(1, &hdrDepthBuf);
+    glBindRenderbuffer(GL_RENDERBUFFER, hdrDepthBuf);
+    mFuncs->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, mWidth, mHeight);
 
     // Bind the depth buffer to the FBO
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                              GL_RENDERBUFFER, depthBuf);
+                              GL_RENDERBUFFER, hdrDepthBuf);
 
     // Set the targets for the fragment output variables
     GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0};
@@ -791,6 +1957,35 @@ void MyWindow::setupFBO() {
         }
     }
 
+    // G-buffer of deferred pass1, on units 3 to 6 for deferredfshader.txt.
+    // 12 bytes of colour per pixel next to the depth.
+    glGenFramebuffers(1, &gBufferFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, gBufferFbo);
+
+    struct { GLuint *tex; GLenum format; } gBuffer[] = {
+        { &gNormalTex,   GL_RG16_SNORM },
+        { &gAlbedoTex,   GL_RGBA8 },
+        { &gSpecularTex, GL_RGBA8 },
+        { &gDepthTex,    GL_DEPTH_COMPONENT24 }
+    };
+    for (int i = 0; i < 4; i++) {
+        glGenTextures(1, gBuffer[i].tex);
+        glActiveTexture(GL_TEXTURE3 + i);
+        glBindTexture(GL_TEXTURE_2D, *gBuffer[i].tex);
+        mFuncs->glTexStorage2D(GL_TEXTURE_2D, 1, gBuffer[i].format, mWidth, mHeight);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, i < 3 ? GL_COLOR_ATTACHMENT0 + i : GL_DEPTH_ATTACHMENT,
+                               GL_TEXTURE_2D, *gBuffer[i].tex, 0);
+    }
+
+    GLenum gBufferDrawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+    mFuncs->glDrawBuffers(3, gBufferDrawBuffers);
+
+    error = mFuncs->glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (error != GL_FRAMEBUFFER_COMPLETE)
+        qDebug() << "gbufferfbo incomplete " << error;
+
     // Create an FBO for the bright-pass filter and blur
     glGenFramebuffers(1, &blurFbo);
     glBindFramebuffer(GL_FRAMEBUFFER, blurFbo);
@@ -854,7 +2049,20 @@ void MyWindow::setupFBO() {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void MyWindow::setupSamplers()
+void BloomRenderer::deleteFBO()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glDeleteFramebuffers(1, &hdrFbo);
+    glDeleteFramebuffers(1, &blurFbo);
+    glDeleteFramebuffers(1, &gBufferFbo);
+    glDeleteRenderbuffers(1, &hdrDepthBuf);
+
+    GLuint textures[] = { hdrTex, tex1, tex2, gNormalTex, gAlbedoTex, gSpecularTex, gDepthTex };
+    glDeleteTextures(7, textures);
+}
+
+void BloomRenderer::setupSamplers()
 {
     // Set up two sampler objects for linear and nearest filtering
     GLuint samplers[2];
@@ -883,14 +2091,15 @@ void MyWindow::setupSamplers()
     mFuncs->glBindSampler(2, nearestSampler);
 }
 
-float MyWindow::computeLogAveLuminance()
+float BloomRenderer::computeLogAveLuminance()
 {
-    float *texData = new float[this->width()*this->height()*3];
+    PROFILE_ZONE("computeLogAveLuminance");
+    float *texData = new float[mWidth*mHeight*3];
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, hdrTex);
     mFuncs->glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, texData);
     float sum = 0.0f;
-    for( int i = 0; i < this->width() * this->height(); i++ )
+    for( int i = 0; i < mWidth * mHeight; i++ )
     {
         float lum = QVector3D::dotProduct(QVector3D(texData[i*3+0], texData[i*3+1], texData[i*3+2]), QVector3D(0.2126f, 0.7152f, 0.0722f) );
         sum += logf( lum + 0.00001f );
@@ -900,12 +2109,12 @@ float MyWindow::computeLogAveLuminance()
     //printf("(%f)\n", exp( sum / (width*height) ) );
     delete [] texData;
 
-    //qDebug() << "Ave luminance: " << expf(sum / (this->width()*this->height()));
+    //qDebug() << "Ave luminance: " << expf(sum / (mWidth*mHeight));
 
-    return expf(sum / (this->width()*this->height()));
+    return expf(sum / (mWidth*mHeight));
 }
 
-void MyWindow::computeBlurWeights()
+void BloomRenderer::computeBlurWeights()
 {
     float sum;
 
@@ -923,7 +2132,7 @@ void MyWindow::computeBlurWeights()
     }
 }
 
-float MyWindow::gauss(float x, float sigma2 )
+float BloomRenderer::gauss(float x, float sigma2 )
 {
     double coeff = 1.0 / (TwoPI * sigma2);
     double expon = -(x * x) / (2.0 * sigma2);
@@ -1,18 +1,32 @@
-#include <QWindow>
-#include <QTimer>
+#ifndef BLOOM_H
+#define BLOOM_H
+
 #include <QString>
-#include <QKeyEvent>
+#include <QElapsedTimer>
 
 #include <QVector3D>
 #include <QMatrix4x4>
 
+#include <QSurfaceFormat>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 #include <QOpenGLFunctions_4_3_Core>
 
 #include <QOpenGLShaderProgram>
 
+#include "bvh.h"
+#include "gputimer.h"
+#include "meshcache.h"
+#include "meshdata.h"
+#include "meshlod.h"
+#include "meshopt.h"
+#include "overdrawcounter.h"
+#include "scene.h"
+#include "renderqueue.h"
+#include "scenestate.h"
 #include "teapot.h"
+#include "transformbatch.h"
+#include "vertexformat.h"
 #include "vboplane.h"
 #include "vbosphere.h"
 
@@ -24,30 +38,271 @@
 #define ToDegree(x) ((x) * 180.0f / M_PI)
 #define TwoPI (float)(2 * M_PI)
 
-//class MyWindow : public QWindow, protected QOpenGLFunctions_3_3_Core
-class MyWindow : public QWindow, protected QOpenGLFunctions
+// Owns every GL object of the bloom pipeline and renders one frame into
+// the framebuffer given by setTargetFramebuffer() (0 for a window, an FBO
+// when running offscreen). The caller makes the context current.
+class BloomRenderer : protected QOpenGLFunctions
 {
-    Q_OBJECT
-
 public:
-    explicit MyWindow();
-    ~MyWindow();
-    virtual void keyPressEvent( QKeyEvent *keyEvent );    
+    enum Pass { Pass1, PassLuminance, Pass2, Pass3, Pass4, Pass5, PassCount };
+    enum { LodLevels = 4, LodBaseLevel = 2 };
+    enum { MeshIds = 2 * LodLevels + 1 };     // teapot levels, sphere levels, plane
+    // Light clusters of pass1, see clustercshader.txt
+    enum { ClusterX = 16, ClusterY = 9, ClusterZ = 24, ClusterMaxLights = 128 };
+    enum { ClusterCount = ClusterX * ClusterY * ClusterZ };
+    enum DepthPrepass { DepthPrepassOff, DepthPrepassOn, DepthPrepassAuto };
+
+    explicit BloomRenderer();
+    ~BloomRenderer();
+
+    static const char *passName(int pass);
+    static const char *depthPrepassName(int mode);
+    static int depthPrepassFromString(const QString &name, bool *ok = 0);   // DepthPrepassOff if unknown
+
+    static QSurfaceFormat surfaceFormat();
+
+    bool initialize();
+    void resize(int w, int h);
+    void render(float timeS);
+
+    void setTargetFramebuffer(GLuint fbo) { mTargetFbo = fbo; }
+
+    // Objects, materials and lights drawn by pass1, the default room
+    // until set. Not thread-safe: set it before rendering starts.
+    void setScene(const SceneStore &scene);
+    const SceneStore &scene() const { return mScene; }
+
+    // Moves one object; the culling BVH is refit before the next frame
+    void setObjectModel(int object, const QMatrix4x4 &model);
+
+    // Skip objects whose world-space box is outside the view frustum
+    bool frustumCulling() const       { return mFrustumCulling; }
+    void setFrustumCulling(bool on)   { mFrustumCulling = on; }
+
+    // Objects drawn and culled in the last frame, and the CPU time spent
+    // on bounds, BVH refit and the frustum tests; of that, the bounds of
+    // moved objects and the refit (or build) alone
+    int    drawnObjects() const  { return mDrawnObjects; }
+    int    culledObjects() const { return mCulledObjects; }
+    qint64 cullNs() const        { return mCullNs; }
+    qint64 refitNs() const       { return mRefitNs; }
+
+    // The culling BVH as refitted so far against one rebuilt from the
+    // current boxes, both culled against the current view
+    BvhComparison compareBvhRebuild();
+
+    // Camera, viewport and view options published by the GUI thread
+    void setSceneState(const SceneState &state);
+
+    // Tone map plus bloom, or tone map only; without bloom pass2 to
+    // pass4 are not run
+    bool displayMode() const       { return mDisplayMode; }
+    void setDisplayMode(bool mode) { mDisplayMode = mode; }
+
+    // Draw the teapot from its 32 Bezier patches with the tessellation
+    // stages instead of the CPU mesh. The level follows the on-screen size.
+    bool gpuTessellation() const        { return mGpuTessellation; }
+    void setGpuTessellation(bool on)    { mGpuTessellation = on; }
+    void setTessPixelsPerSegment(float pixels) { mTessPixelsPerSegment = pixels; }
+
+    // Pick the teapot and sphere levels from their on-screen size, or
+    // always draw the LodBaseLevel meshes
+    bool lodEnabled() const        { return mLodEnabled; }
+    void setLodEnabled(bool on)    { mLodEnabled = on; }
+
+    // Triangles drawn by the LOD meshes in the last frame, and what the
+    // base levels would have drawn
+    qint64 lodTriangles() const         { return mLodTriangles; }
+    qint64 lodBaselineTriangles() const { return mLodBaselineTriangles; }
+
+    // Upload meshes interleaved with octahedral normals, half-float tex
+    // coords and 16-bit indices. Only read by initialize().
+    bool packedVertices() const       { return mPackedVertices; }
+    void setPackedVertices(bool on)   { mPackedVertices = on; }
+    const PackStats &packStats() const { return mPackStats; }
+
+    // Reorder index buffers for the vertex cache and overdraw before
+    // upload. Only read by initialize().
+    bool optimizeIndices() const       { return mOptimizeIndices; }
+    void setOptimizeIndices(bool on)   { mOptimizeIndices = on; }
+
+    // Generate the teapot, sphere and plane as triangle strips joined by
+    // primitive restart instead of triangle lists. Strips keep their
+    // generation order, optimizeIndices() only reorders lists. Only read
+    // by initialize().
+    bool triangleStrips() const       { return mTriangleStrips; }
+    void setTriangleStrips(bool on)   { mTriangleStrips = on; }
+    // Index bytes pass1 fetched for its meshes in the last frame
+    qint64 indexBytes() const         { return mIndexBytes; }
+
+    // Weld the duplicated seam vertices of the teapot levels before
+    // upload. Only read by initialize().
+    bool weldTeapot() const       { return mWeldTeapot; }
+    void setWeldTeapot(bool on)   { mWeldTeapot = on; }
+
+    // Directory of the binary mesh cache, empty to always generate.
+    // Only read by initialize().
+    void setMeshCacheDir(const QString &dir) { mMeshCache.setDirectory(dir); }
+
+    // Draw pass1 with one glMultiDrawElementsIndirect over the merged mesh
+    // pool, objects of the same mesh as instances, instead of a draw each
+    bool indirectDraws() const       { return mIndirectDraws; }
+    void setIndirectDraws(bool on)   { mIndirectDraws = on; }
+
+    // Draw calls issued by pass1 in the last frame
+    int drawCalls() const { return mDrawCalls; }
+
+    // Program, vertex array and material switches of pass1 in the last
+    // frame, as submitted from the sorted render queue
+    int programChanges() const  { return mProgramChanges; }
+    int vaoChanges() const      { return mVaoChanges; }
+    int materialChanges() const { return mMaterialChanges; }
+    int stateChanges() const    { return mProgramChanges + mVaoChanges + mMaterialChanges; }
+
+    // Lay down pass1 depth with a trivial program first, then light with
+    // GL_EQUAL and depth writes off so every pixel is shaded once. Auto
+    // turns it on while the depth complexity is above the threshold.
+    int  depthPrepass() const               { return mDepthPrepass; }
+    void setDepthPrepass(int mode)          { mDepthPrepass = mode; }
+    void setDepthPrepassThreshold(float t)  { mDepthPrepassThreshold = t; }
+    bool depthPrepassActive() const         { return mDepthPrepassActive; }
+
+    // Draw pass1 into a G-buffer (octahedral normal, Kd and Ks in RGBA8,
+    // depth) and light it with one full-screen pass, so every pixel is lit
+    // once whatever the overdraw. The pre-pass and counters still apply.
+    bool deferredShading() const      { return mDeferredShading; }
+    void setDeferredShading(bool on)  { mDeferredShading = on; }
+
+    // Draw spheres as one instanced draw of camera-facing quads, ray-cast
+    // per fragment with an exact depth, instead of their LOD meshes.
+    // Assumes uniformly scaled sphere models.
+    bool sphereImpostors() const      { return mSphereImpostors; }
+    void setSphereImpostors(bool on)  { mSphereImpostors = on; }
+    // Spheres drawn as impostors and indices submitted for all spheres,
+    // mesh indices or 4 vertices per impostor, in the last frame. Mesh
+    // vertices shaded are fewer, by the post-transform cache reuse.
+    int    impostorCount() const     { return mImpostorObjects.size(); }
+    qint64 sphereIndices() const     { return mSphereIndices; }
 
-private slots:
-    void render();
+    // Count pass1 samples with occlusion queries; always on in auto mode
+    bool overdrawCounter() const      { return mOverdrawCounter; }
+    void setOverdrawCounter(bool on)  { mOverdrawCounter = on; }
+    // Per pixel, a few frames behind: fragments passing the depth test
+    // before lighting (the overdraw without a pre-pass), and shaded ones
+    float depthComplexity() const     { return mDepthComplexity; }
+    float shadedComplexity() const    { return mOverdraw.complexity(OverdrawCounter::ShadePass); }
 
-private:    
-    void initialize();
-    void modCurTime();
+    int width() const  { return mWidth; }
+    int height() const { return mHeight; }
+
+    // The bloom buffers are 1/downscale of the viewport
+    int  bloomDownscale() const { return mBloomDownscale; }
+    void setBloomDownscale(int downscale);
+    float blurSigma2() const { return sigma2; }
+    void  setBlurSigma2(float s2);
+
+    // CPU time spent submitting each pass of the last frame
+    qint64 passCpuNs(int pass) const { return mPassCpuNs[pass]; }
+
+    // Rolling GPU time per pass, a few frames behind the CPU
+    GpuTimer::Stats gpuPassStats(int pass) const { return mGpuTimer.stats(pass); }
+    GpuTimer::Stats gpuFrameStats() const        { return mGpuTimer.frameStats(); }
+    GpuTimer *gpuTimer() { return &mGpuTimer; }
+
+    // Print the GPU pass statistics every intervalMs, 0 to disable
+    void setGpuStatsInterval(int intervalMs) { mGpuStatsInterval = intervalMs; }
+    int  gpuStatsInterval() const            { return mGpuStatsInterval; }
+
+private:
+    // Programs of pass1, the first field of the render queue key
+    enum DrawProgram { ProgramMesh, ProgramTess, ProgramImpostor };
+    // What a pass1 draw writes: lit colour, depth only or the G-buffer
+    enum DrawOutput { OutputShaded, OutputDepth, OutputGBuffer };
+
+    // One object drawn by pass1
+    struct DrawItem
+    {
+        const MeshBuffers *mesh;  // 0 for the teapot patches
+        int   meshId;             // < MeshIds, the same for the same mesh; -1 for patches
+        int   program;            // DrawProgram
+        int   object;
+        int   material;
+        float depth;              // view-space distance along -z of the object origin
+    };
+
+    // std430 entry of the Lights buffer of fshader.txt and clustercshader.txt
+    struct LightGpu
+    {
+        float position[4];        // eye coords, radius in w
+        float intensity[4];
+    };
+
+    // std430 entry of the Impostors buffer of impostorvshader.txt
+    struct ImpostorGpu
+    {
+        float centerRadius[4];    // eye coords, radius in w
+        float kd[4];
+        float ks[4];
+        float kaShininess[4];     // Ka, shininess in w
+    };
+
+    // Locations of the per-object matrices of a program
+    struct ObjectUniforms
+    {
+        GLint modelView, normalMatrix, mvp;
+    };
+
+    // Layout read by glMultiDrawElementsIndirect
+    struct DrawCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint  baseVertex;
+        GLuint baseInstance;
+    };
 
     void initShaders();
-    void CreateVertexBuffer();    
+    void initTessShaders();
+    void initClusterShader();
+    void initDeferredShaders();
+    void initImpostorShaders();
+    void CreateVertexBuffer();
+    QByteArray  meshParams(const QString &generator) const;
+    bool        loadCachedMesh(const QByteArray &params, MeshBuffers &mesh);
+    MeshBuffers uploadMesh(const QByteArray &params, MeshData &&data);
+    MeshBuffers uploadPayload(const MeshPayload &payload);
+    void setupVertexFormat(quint32 layout, GLuint vbo, int nVerts);
+    void buildMeshPool();
+    void reserveObjects(int count);
+    void weldTeapot(Teapot *teapot, int grid);
+    int  selectLod(const LodChain &chain, int object);
     void initMatrices();
     void setupFBO();
+    void deleteFBO();
     void setupSamplers();
 
     void pass1();
+    void updateBounds();
+    void cullObjects();
+    void collectDrawItems(QVector<DrawItem> &items);
+    void updateLights();
+    void setLightUniforms(QOpenGLShaderProgram *program);
+    void setMaterialUniforms(QOpenGLShaderProgram *program, int material);
+    void setObjectUniforms(const ObjectUniforms &uniforms, const ObjectGpu &object);
+    void drawMesh(const MeshBuffers &mesh);
+    void queueDrawItems(const QVector<DrawItem> &items, bool meshes);
+    QOpenGLShaderProgram *drawProgram(int program, int output) const;
+    const ObjectUniforms &drawUniforms(int program, int output) const;
+    void bindDrawProgram(int program, int output);
+    void submitQueue(const QVector<DrawItem> &items, int output);
+    void uploadIndirect(const QVector<DrawItem> &items);
+    void drawIndirect(int output);
+    void drawScene(bool indirect, int output);
+    void uploadImpostors();
+    void drawImpostors(int output);
+    void updateDepthPrepass();
+    void lightGBuffer();
     void pass2();
     void pass3();
     void pass4();
@@ -55,43 +310,122 @@ private:
 
     void  PrepareTexture(GLenum TextureTarget, const QString& FileName, GLuint& TexObject, bool flip);
 
+    void  printGpuStats();
+
     float computeLogAveLuminance();
     void  computeBlurWeights();
     float gauss(float x, float sigma2 );
 
-protected:
-    void resizeEvent(QResizeEvent *);
-
 private:
-    QOpenGLContext *mContext;
     QOpenGLFunctions_4_3_Core *mFuncs;
 
     QOpenGLShaderProgram *mProgram;
+    QOpenGLShaderProgram *mTessProgram;
+    QOpenGLShaderProgram *mDepthProgram, *mTessDepthProgram;   // pre-pass
+    QOpenGLShaderProgram *mGBufferProgram, *mTessGBufferProgram;   // deferred
+    QOpenGLShaderProgram *mDeferredProgram;
+    QOpenGLShaderProgram *mImpostorProgram, *mImpostorDepthProgram, *mImpostorGBufferProgram;
+    QOpenGLShaderProgram *mClusterProgram;
+
+    bool   mInitialized;
+    int    mWidth, mHeight;
+    int    mBloomDownscale;
+    qint64 mPassCpuNs[PassCount];
 
-    QTimer mRepaintTimer;
-    double currentTimeMs;
-    double currentTimeS;
-    bool   mUpdateSize;
+    GpuTimer      mGpuTimer;
+    int           mGpuStatsInterval;
+    QElapsedTimer mGpuStatsTimer;
     float  tPrev, angle;
 
-    bool   displayMode = true; // with (true) or without effect (false)
+    bool   mDisplayMode; // with (true) or without effect (false)
+    bool   mGpuTessellation;
+    float  mTessPixelsPerSegment;
 
-    GLuint mVAOTeapot, mVAOPlane, mVAOSphere, mVAOFSQuad, mVBO, mIBO, hdrFbo, blurFbo;
+    bool   mLodEnabled;
+    float  mLodPixelsPerSegment;
+    qint64 mLodTriangles, mLodBaselineTriangles;
+    LodChain    mTeapotLod, mSphereLod;
+    QVector<LodSelector> mObjectLod;   // per scene object
+
+    bool         mFrustumCulling;
+    bool         mBoundsDirty;         // rebuild the BVH before the next frame
+    Bvh          mBvh;
+    QVector<Aabb> mWorldBounds;        // per scene object
+    QVector<int> mMovedObjects;        // since the last frame
+    QVector<int> mVisibleObjects;      // scene order
+    int          mDrawnObjects, mCulledObjects;
+    qint64       mCullNs, mRefitNs;
+
+    bool      mPackedVertices;
+    PackStats mPackStats;
+
+    bool       mOptimizeIndices;
+    CacheStats mCacheBefore, mCacheAfter;
+
+    bool       mTriangleStrips;
+    CacheStats mUploadedCache;      // index buffers as uploaded
+    qint64     mUploadedIndexBytes;
+    qint64     mIndexBytes;
+
+    bool       mWeldTeapot;
+    MeshCache  mMeshCache;
+
+    qint64     mReleasedMeshBytes;
+
+    bool       mIndirectDraws;
+    int        mDrawCalls;
+    GLuint     mPoolVao, mPoolVbo, mPoolIbo;
+    GLenum     mPoolIndexType, mPoolMode;
+    GLuint     mObjectIndexBuffer, mObjectBuffer, mIndirectBuffer;
+    int        mObjectCapacity;
+    QVector<DrawItem>    mDrawItems;
+    QVector<int>         mDrawOrder;       // object per slot of mObjectData
+    QVector<ObjectGpu>   mObjectData;
+    QVector<DrawCommand> mCommands;
+    RenderQueue          mQueue;
+    int                  mProgramChanges, mVaoChanges, mMaterialChanges;
+
+    int             mDepthPrepass;
+    float           mDepthPrepassThreshold;
+    bool            mDepthPrepassActive;
+    bool            mOverdrawCounter;
+    OverdrawCounter mOverdraw;
+    float           mDepthComplexity;
+    bool            mDeferredShading;
+
+    bool                 mSphereImpostors;
+    qint64               mSphereIndices;
+    QVector<int>         mImpostorObjects;   // visible spheres, this frame
+    QVector<ImpostorGpu> mImpostorData;
+    GLuint               mImpostorBuffer, mImpostorVao;
+
+    ObjectUniforms       mObjectUniforms, mTessObjectUniforms;
+    ObjectUniforms       mDepthObjectUniforms, mTessDepthObjectUniforms;
+    ObjectUniforms       mGBufferObjectUniforms, mTessGBufferObjectUniforms;
+    QVector<LightGpu>    mLightData;       // view space, this frame
+    GLuint               mLightBuffer, mClusterCountBuffer, mClusterLightBuffer;
+    float                mClusterSliceScale, mClusterSliceBias;
+
+    GLuint mVAOFSQuad, mVBO, mIBO, hdrFbo, blurFbo;
+    GLuint mTargetFbo;
     GLuint mPositionBufferHandle, mColorBufferHandle;
     GLuint mRotationMatrixLocation;
 
+    GLuint mVAOTeapotPatches;
+    GLsizei mTeapotPatchVerts;
+
     GLuint pass1Index, pass2Index, pass3Index, pass4Index, pass5Index;
-    GLuint hdrTex, tex1, tex2;
+    GLuint tessPass1Index;
+    GLuint hdrTex, hdrDepthBuf, tex1, tex2;
+    GLuint gBufferFbo, gNormalTex, gAlbedoTex, gSpecularTex, gDepthTex;
     GLuint bloomBufWidth, bloomBufHeight;
     GLuint linearSampler, nearestSampler;
 
 
-    Teapot    *mTeapot;
-    VBOPlane  *mPlane;
-    VBOSphere *mSphere;
+    MeshBuffers mPlaneMesh;
 
-    QMatrix4x4 ModelMatrixTeapot, ModelMatrixSphere, ViewMatrix, ProjectionMatrix;
-    QMatrix4x4 ModelMatrixBackPlane, ModelMatrixBotPlane, ModelMatrixTopPlane;
+    SceneStore mScene;
+    QMatrix4x4 ViewMatrix, ProjectionMatrix;
 
     float weights[10], sigma2; // for gaussian blur
     float aveLum;
@@ -99,3 +433,5 @@ private:
     //debug
     void printMatrix(const QMatrix4x4& mat);
 };
+
+#endif // BLOOM_H
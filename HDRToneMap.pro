@@ -0,0 +1,15 @@
+include(bloom.pri)
+
+TARGET = HDRToneMap
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += main.cpp \
+    mywindow.cpp \
+    renderthread.cpp
+
+HEADERS += \
+    mywindow.h \
+    renderthread.h
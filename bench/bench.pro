@@ -0,0 +1,15 @@
+include(../bloom.pri)
+
+TARGET = bench
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += main.cpp \
+    benchmark.cpp \
+    meshbench.cpp
+
+HEADERS += \
+    benchmark.h \
+    meshbench.h
@@ -0,0 +1,230 @@
+#include "benchmark.h"
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+
+#include <algorithm>
+#include <cmath>
+
+// Moving objects drift at this speed, in directions spread over the sphere
+// by the golden angle
+static const float DriftSpeed  = 2.0f;   // units per simulated second
+static const float GoldenAngle = 2.39996323f;
+
+Benchmark::Benchmark(OffscreenRenderer *offscreen, int frames, int warmup, float timeStep)
+    : mOffscreen(offscreen), mFrames(frames), mWarmup(warmup), mTimeStep(timeStep)
+{
+}
+
+BenchResult Benchmark::run(const BenchConfig &config)
+{
+    BenchResult result;
+    result.config = config;
+
+    BloomRenderer *renderer = mOffscreen->renderer();
+
+    mOffscreen->resize(config.size);
+    renderer->setDisplayMode(config.bloom);
+    renderer->setBloomDownscale(config.downscale);
+    renderer->setDepthPrepass(config.depthPrepass);
+    renderer->setDeferredShading(config.deferred);
+    renderer->setSphereImpostors(config.impostors);
+
+    // Keep every GPU sample of the run, the ring hands them back in order
+    GpuTimer *gpuTimer = renderer->gpuTimer();
+    gpuTimer->collect(true);
+    gpuTimer->setWindow(mWarmup + mFrames);
+
+    // Moved objects leave from where the scene put them, spread over the
+    // scene order; the scene is restored after the run, so the next one
+    // starts from a fresh BVH again
+    SceneStore scene = renderer->scene();
+    QVector<int>       moving;
+    QVector<QVector3D> drift;
+    int movingCount = qMin(config.moving, scene.objectCount());
+    for (int k = 0; k < movingCount; k++)
+    {
+        float y = 1.0f - 2.0f * (k + 0.5f) / movingCount;
+        float r = std::sqrt(qMax(0.0f, 1.0f - y * y));
+        float a = k * GoldenAngle;
+        moving << k * scene.objectCount() / movingCount;
+        drift << DriftSpeed * QVector3D(r * std::cos(a), y, r * std::sin(a));
+    }
+
+    // Every configuration replays the same simulated timeline
+    for (int i = 0; i < mWarmup + mFrames; i++)
+    {
+        float timeS = i * mTimeStep;
+
+        for (int k = 0; k < moving.size(); k++)
+        {
+            QMatrix4x4 model;
+            model.translate(drift[k] * timeS);
+            renderer->setObjectModel(moving[k], model * scene.model(moving[k]));
+        }
+
+        QElapsedTimer cpuTimer;
+        cpuTimer.start();
+        mOffscreen->renderFrame(timeS);
+        qint64 cpuNs = cpuTimer.nsecsElapsed();
+
+        if (i < mWarmup)
+            continue;
+
+        result.cpuMs.append(cpuNs / 1.0e6);
+        for (int p = 0; p < BloomRenderer::PassCount; p++)
+            result.passCpuMs[p].append(renderer->passCpuNs(p) / 1.0e6);
+        result.cullCpuMs.append(renderer->cullNs() / 1.0e6);
+        result.refitCpuMs.append(renderer->refitNs() / 1.0e6);
+    }
+
+    gpuTimer->collect(true);
+    result.drawCalls          = renderer->drawCalls();
+    result.stateChanges       = renderer->stateChanges();
+    result.depthComplexity    = renderer->depthComplexity();
+    result.shadedComplexity   = renderer->shadedComplexity();
+    result.depthPrepassActive = renderer->depthPrepassActive();
+    result.drawnObjects       = renderer->drawnObjects();
+    result.culledObjects      = renderer->culledObjects();
+    result.sphereIndices      = renderer->sphereIndices();
+    result.triangleStrips     = renderer->triangleStrips();
+    result.indexBytes         = renderer->indexBytes();
+    result.bvh                = renderer->compareBvhRebuild();
+
+    if (!moving.isEmpty())
+        renderer->setScene(scene);
+
+    // Frames skipped by a busy ring are missing, drop warmup from the front
+    result.gpuMs = gpuTimer->samples(gpuTimer->intervals());
+    result.gpuMs = result.gpuMs.mid(qMax(0, result.gpuMs.size() - mFrames));
+    for (int p = 0; p < BloomRenderer::PassCount; p++) {
+        QVector<double> s = gpuTimer->samples(p);
+        result.passGpuMs[p] = s.mid(qMax(0, s.size() - mFrames));
+    }
+
+    return result;
+}
+
+double Benchmark::percentile(QVector<double> values, double p)
+{
+    if (values.isEmpty())
+        return 0.0;
+
+    // Nearest-rank percentile
+    std::sort(values.begin(), values.end());
+    int rank = (int)std::ceil(p / 100.0 * values.size());
+    rank = qBound(1, rank, values.size());
+
+    return values[rank - 1];
+}
+
+static QJsonObject percentiles(const QVector<double> &values)
+{
+    QJsonObject obj;
+    obj["p50"] = Benchmark::percentile(values, 50.0);
+    obj["p95"] = Benchmark::percentile(values, 95.0);
+    obj["p99"] = Benchmark::percentile(values, 99.0);
+
+    return obj;
+}
+
+QString Benchmark::toJson(const QList<BenchResult> &results)
+{
+    QJsonArray runs;
+    foreach (const BenchResult &r, results)
+    {
+        QJsonObject run;
+        run["width"]                = r.config.size.width();
+        run["height"]               = r.config.size.height();
+        run["bloom"]                = r.config.bloom;
+        run["downscale"]            = r.config.downscale;
+        run["objects"]              = r.config.objects;
+        run["moving"]               = r.config.moving;
+        run["depth_prepass"]        = BloomRenderer::depthPrepassName(r.config.depthPrepass);
+        run["depth_prepass_active"] = r.depthPrepassActive;
+        run["shading"]              = r.config.deferred ? "deferred" : "forward";
+        run["spheres"]              = r.config.impostors ? "impostor" : "mesh";
+        run["sphere_indices"]       = double(r.sphereIndices);
+        run["indices"]              = r.triangleStrips ? "strips" : "lists";
+        run["index_bytes"]          = double(r.indexBytes);
+        run["draw_calls"]           = r.drawCalls;
+        run["state_changes"]        = r.stateChanges;
+        run["depth_complexity"]     = r.depthComplexity;
+        run["shaded_complexity"]    = r.shadedComplexity;
+        run["drawn_objects"]        = r.drawnObjects;
+        run["culled_objects"]       = r.culledObjects;
+        run["cull_cpu_ms"]          = percentiles(r.cullCpuMs);
+        run["refit_cpu_ms"]         = percentiles(r.refitCpuMs);
+
+        QJsonObject bvh;
+        bvh["refit_cost"]           = r.bvh.refitCost;
+        bvh["rebuild_cost"]         = r.bvh.rebuildCost;
+        bvh["refit_box_tests"]      = r.bvh.refitTests;
+        bvh["rebuild_box_tests"]    = r.bvh.rebuildTests;
+        bvh["rebuild_ms"]           = r.bvh.rebuildNs / 1.0e6;
+        run["bvh"]                  = bvh;
+
+        run["frames"]               = r.cpuMs.size();
+        run["cpu_ms"]               = percentiles(r.cpuMs);
+        run["gpu_ms"]               = percentiles(r.gpuMs);
+
+        QJsonObject passes;
+        for (int p = 0; p < BloomRenderer::PassCount; p++)
+        {
+            QJsonObject pass;
+            pass["cpu_ms"] = percentiles(r.passCpuMs[p]);
+            pass["gpu_ms"] = percentiles(r.passGpuMs[p]);
+            passes[BloomRenderer::passName(p)] = pass;
+        }
+        run["passes"]               = passes;
+
+        runs.append(run);
+    }
+
+    QJsonObject root;
+    root["runs"] = runs;
+
+    return QString::fromUtf8(QJsonDocument(root).toJson());
+}
+
+QString Benchmark::toCsv(const QList<BenchResult> &results)
+{
+    QString csv;
+    QTextStream out(&csv);
+
+    out << "width,height,bloom,downscale,objects,moving,depth_prepass,shading,spheres,indices,frames,metric,p50,p95,p99\n";
+    foreach (const BenchResult &r, results)
+    {
+        QString prefix = QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,")
+                .arg(r.config.size.width()).arg(r.config.size.height())
+                .arg(r.config.bloom ? 1 : 0).arg(r.config.downscale)
+                .arg(r.config.objects).arg(r.config.moving)
+                .arg(BloomRenderer::depthPrepassName(r.config.depthPrepass))
+                .arg(r.config.deferred ? "deferred" : "forward")
+                .arg(r.config.impostors ? "impostor" : "mesh")
+                .arg(r.triangleStrips ? "strips" : "lists")
+                .arg(r.cpuMs.size());
+
+        QList<QPair<QString, const QVector<double> *> > metrics;
+        metrics << qMakePair(QString("cpu"), &r.cpuMs) << qMakePair(QString("gpu"), &r.gpuMs)
+                << qMakePair(QString("cpu_cull"), &r.cullCpuMs) << qMakePair(QString("cpu_refit"), &r.refitCpuMs);
+        for (int p = 0; p < BloomRenderer::PassCount; p++)
+            metrics << qMakePair(QString("cpu_") + BloomRenderer::passName(p), &r.passCpuMs[p])
+                    << qMakePair(QString("gpu_") + BloomRenderer::passName(p), &r.passGpuMs[p]);
+
+        for (int m = 0; m < metrics.size(); m++)
+        {
+            const QVector<double> &values = *metrics[m].second;
+            out << prefix << metrics[m].first << ","
+                << percentile(values, 50.0) << ","
+                << percentile(values, 95.0) << ","
+                << percentile(values, 99.0) << "\n";
+        }
+    }
+    out.flush();
+
+    return csv;
+}
@@ -0,0 +1,63 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QSize>
+#include <QList>
+#include <QVector>
+#include <QString>
+
+#include "Bloom.h"
+#include "offscreenrenderer.h"
+
+struct BenchConfig
+{
+    QSize size;
+    bool  bloom;      // tone map + bloom combine, or tone map only
+    int   downscale;  // bloom buffer is 1/downscale of the viewport
+    int   objects;    // scene objects, for scaling runs
+    int   depthPrepass; // BloomRenderer::DepthPrepass
+    bool  deferred;     // pass1 through the G-buffer
+    bool  impostors;    // spheres as ray-cast impostors
+    int   moving;       // objects moved every frame, so the BVH is refit
+};
+
+struct BenchResult
+{
+    BenchConfig     config;
+    QVector<double> cpuMs;                                 // whole frame, submission + readback
+    QVector<double> gpuMs;                                 // whole frame, GPU timestamps
+    QVector<double> passCpuMs[BloomRenderer::PassCount];
+    QVector<double> passGpuMs[BloomRenderer::PassCount];
+    int             drawCalls;                             // pass1, last frame
+    int             stateChanges;                          // pass1 program, VAO and material, last frame
+    float           depthComplexity, shadedComplexity;     // pass1 samples per pixel, last counted frame
+    bool            depthPrepassActive;                    // last frame, auto may switch it
+    int             drawnObjects, culledObjects;           // last frame
+    qint64          sphereIndices;                         // last frame, mesh indices or 4 per impostor
+    bool            triangleStrips;                        // meshes uploaded as strips, not lists
+    qint64          indexBytes;                            // pass1 mesh indices fetched, last frame
+    QVector<double> cullCpuMs;                             // bounds, BVH and frustum tests
+    QVector<double> refitCpuMs;                            // of that, bounds and BVH refit
+    BvhComparison   bvh;                                   // refitted tree against a rebuild, last frame
+};
+
+// Renders a fixed number of frames per configuration with a fixed simulated
+// time step, so two runs on the same machine see exactly the same frames.
+class Benchmark
+{
+public:
+    Benchmark(OffscreenRenderer *offscreen, int frames, int warmup, float timeStep);
+
+    BenchResult run(const BenchConfig &config);
+
+    static double  percentile(QVector<double> values, double p);
+    static QString toJson(const QList<BenchResult> &results);
+    static QString toCsv(const QList<BenchResult> &results);
+
+private:
+    OffscreenRenderer *mOffscreen;
+    int   mFrames, mWarmup;
+    float mTimeStep;
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,244 @@
+#include "benchmark.h"
+#include "meshbench.h"
+#include "offscreenrenderer.h"
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+
+static QList<QSize> parseSizes(const QString &text)
+{
+    QList<QSize> sizes;
+    foreach (const QString &item, text.split(',', QString::SkipEmptyParts))
+    {
+        QStringList parts = item.split('x');
+        if (parts.size() != 2)
+            continue;
+
+        int w = parts[0].toInt();
+        int h = parts[1].toInt();
+        if (w > 0 && h > 0)
+            sizes << QSize(w, h);
+    }
+    return sizes;
+}
+
+static QList<int> parseInts(const QString &text)
+{
+    QList<int> values;
+    foreach (const QString &item, text.split(',', QString::SkipEmptyParts))
+    {
+        int v = item.toInt();
+        if (v > 0)
+            values << v;
+    }
+    return values;
+}
+
+static bool writeReport(const QCommandLineParser &parser, const QString &report)
+{
+    QFile file;
+    if (parser.isSet("output"))
+    {
+        file.setFileName(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        {
+            qWarning() << "Could not write" << file.fileName();
+            return false;
+        }
+    }
+    else
+    {
+        file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+
+    QTextStream out(&file);
+    out << report;
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Deterministic benchmark of the bloom pipeline");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "frames",      "Measured frames per configuration.", "n", "300" },
+        { "warmup",      "Unmeasured frames rendered first.", "n", "30" },
+        { "time-step",   "Simulated seconds per frame.", "s", "0.016667" },
+        { "resolutions", "Comma separated list of WxH sizes.", "list", "640x480,1280x720,1920x1080" },
+        { "downscales",  "Comma separated list of bloom buffer downscale factors.", "list", "4,8,16" },
+        { "no-bloom",    "Also measure every configuration with bloom disabled." },
+        { "gpu-tess",    "Tessellate the teapot on the GPU." },
+        { "no-lod",      "Draw every mesh at its fixed base resolution." },
+        { "indirect",    "Draw the scene with one multi-draw-indirect call." },
+        { "no-cull",     "Draw every object, also those outside the view." },
+        { "depth-prepass", "Comma separated depth pre-pass modes: off, on, auto.", "list", "off" },
+        { "depth-prepass-threshold", "Depth complexity above which auto turns the pre-pass on.", "x", "1.5" },
+        { "overdraw",    "Count pass1 depth complexity with occlusion queries; auto mode always counts." },
+        { "shading",     "Comma separated pass1 shading modes: forward, deferred.", "list", "forward" },
+        { "spheres",     "Comma separated sphere modes: mesh, impostor.", "list", "mesh" },
+        { "packed-vertices", "Upload meshes in the packed interleaved vertex format." },
+        { "no-index-opt", "Upload the index buffers in generation order." },
+        { "weld",        "Weld the duplicated seam vertices of the teapot." },
+        { "strips",      "Upload meshes as triangle strips joined by primitive restart." },
+        { "mesh-cache",  "Load and save generated meshes in this directory.", "dir" },
+        { "scene",       "Load objects, materials and lights from this JSON file.", "file" },
+        { "stress",      "Comma separated object counts of generated scenes, run one after another.", "list" },
+        { "stress-lights", "Lights of the generated scenes.", "n", "8" },
+        { "move",        "Objects moved every frame, so culling refits its BVH instead of building it once.", "n", "0" },
+        { "format",      "Report format, json or csv.", "fmt", "json" },
+        { "output",      "Write the report to this file instead of stdout.", "file" },
+        { "tessellation", "Benchmark serial against parallel teapot tessellation instead." },
+        { "bezier",      "Benchmark scalar against SIMD teapot patch evaluation instead." },
+        { "strip-report", "Compare triangle list and strip index buffers of the meshes instead." },
+        { "grids",       "Comma separated grid sizes for --tessellation, --bezier and --strip-report.", "list", "14,32,64,128,256" },
+        { "repeats",     "Runs per grid size for --tessellation and --bezier, the best one counts.", "n", "5" },
+    });
+    parser.process(a);
+
+    bool csv = parser.value("format") == "csv";
+
+    QString report;
+    if (parser.isSet("tessellation"))
+    {
+        report = MeshBench::tessellation(parseInts(parser.value("grids")),
+                                         qMax(1, parser.value("repeats").toInt()), csv);
+        return writeReport(parser, report) ? 0 : 1;
+    }
+    if (parser.isSet("bezier"))
+    {
+        report = MeshBench::bezier(parseInts(parser.value("grids")),
+                                   qMax(1, parser.value("repeats").toInt()), csv);
+        return writeReport(parser, report) ? 0 : 1;
+    }
+    if (parser.isSet("strip-report"))
+    {
+        report = MeshBench::strips(parseInts(parser.value("grids")), csv);
+        return writeReport(parser, report) ? 0 : 1;
+    }
+
+    QList<QSize> sizes      = parseSizes(parser.value("resolutions"));
+    QList<int>   downscales = parseInts(parser.value("downscales"));
+    if (sizes.isEmpty() || downscales.isEmpty())
+    {
+        qWarning( "Nothing to benchmark" );
+        return 1;
+    }
+
+    OffscreenRenderer offscreen;
+    offscreen.renderer()->setPackedVertices(parser.isSet("packed-vertices"));
+    offscreen.renderer()->setOptimizeIndices(!parser.isSet("no-index-opt"));
+    offscreen.renderer()->setWeldTeapot(parser.isSet("weld"));
+    offscreen.renderer()->setTriangleStrips(parser.isSet("strips"));
+    offscreen.renderer()->setMeshCacheDir(parser.value("mesh-cache"));
+    if (parser.isSet("scene"))
+    {
+        SceneStore scene;
+        if (!scene.load(parser.value("scene")))
+            return 1;
+        offscreen.renderer()->setScene(scene);
+    }
+    if (!offscreen.create(sizes.first()))
+        return 1;
+    offscreen.renderer()->setGpuTessellation(parser.isSet("gpu-tess"));
+    offscreen.renderer()->setLodEnabled(!parser.isSet("no-lod"));
+    offscreen.renderer()->setIndirectDraws(parser.isSet("indirect"));
+    offscreen.renderer()->setFrustumCulling(!parser.isSet("no-cull"));
+    offscreen.renderer()->setDepthPrepassThreshold(parser.value("depth-prepass-threshold").toFloat());
+    offscreen.renderer()->setOverdrawCounter(parser.isSet("overdraw"));
+
+    QList<int> prepassModes;
+    foreach (const QString &name, parser.value("depth-prepass").split(',', QString::SkipEmptyParts))
+    {
+        bool ok;
+        int mode = BloomRenderer::depthPrepassFromString(name.trimmed(), &ok);
+        if (ok)
+            prepassModes << mode;
+        else
+            qWarning() << "Unknown depth pre-pass mode" << name;
+    }
+    if (prepassModes.isEmpty())
+        prepassModes << BloomRenderer::DepthPrepassOff;
+
+    QList<bool> shadingModes;   // deferred or not
+    foreach (const QString &name, parser.value("shading").split(',', QString::SkipEmptyParts))
+    {
+        if (name.trimmed() == "forward" || name.trimmed() == "deferred")
+            shadingModes << (name.trimmed() == "deferred");
+        else
+            qWarning() << "Unknown shading mode" << name;
+    }
+    if (shadingModes.isEmpty())
+        shadingModes << false;
+
+    QList<bool> sphereModes;    // impostors or not
+    foreach (const QString &name, parser.value("spheres").split(',', QString::SkipEmptyParts))
+    {
+        if (name.trimmed() == "mesh" || name.trimmed() == "impostor")
+            sphereModes << (name.trimmed() == "impostor");
+        else
+            qWarning() << "Unknown sphere mode" << name;
+    }
+    if (sphereModes.isEmpty())
+        sphereModes << false;
+
+    Benchmark bench(&offscreen,
+                    qMax(1, parser.value("frames").toInt()),
+                    qMax(0, parser.value("warmup").toInt()),
+                    parser.value("time-step").toFloat());
+
+    QList<bool> bloomModes;
+    bloomModes << true;
+    if (parser.isSet("no-bloom"))
+        bloomModes << false;
+
+    // 0 keeps the scene loaded above
+    QList<int> objectCounts = parseInts(parser.value("stress"));
+    if (objectCounts.isEmpty())
+        objectCounts << 0;
+
+    QList<BenchResult> results;
+    foreach (int objects, objectCounts)
+    {
+        if (objects > 0)
+            offscreen.renderer()->setScene(SceneStore::stress(objects, qMax(0, parser.value("stress-lights").toInt())));
+
+        foreach (const QSize &size, sizes)
+            foreach (int downscale, downscales)
+                foreach (bool bloom, bloomModes)
+                    foreach (int prepass, prepassModes)
+                        foreach (bool deferred, shadingModes)
+                            foreach (bool impostors, sphereModes)
+                            {
+                                BenchConfig config;
+                                config.size         = size;
+                                config.bloom        = bloom;
+                                config.downscale    = downscale;
+                                config.objects      = offscreen.renderer()->scene().objectCount();
+                                config.depthPrepass = prepass;
+                                config.deferred     = deferred;
+                                config.impostors    = impostors;
+                                config.moving       = qMin(qMax(0, parser.value("move").toInt()), config.objects);
+
+                                qDebug() << "bench" << size << "downscale" << downscale << "bloom" << bloom
+                                         << "objects" << config.objects << "moving" << config.moving
+                                         << "depth pre-pass" << BloomRenderer::depthPrepassName(prepass)
+                                         << "shading" << (deferred ? "deferred" : "forward")
+                                         << "spheres" << (impostors ? "impostor" : "mesh");
+                                results << bench.run(config);
+                            }
+    }
+
+    report = csv ? Benchmark::toCsv(results) : Benchmark::toJson(results);
+
+    return writeReport(parser, report) ? 0 : 1;
+}
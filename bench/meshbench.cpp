@@ -0,0 +1,268 @@
+#include "meshbench.h"
+#include "meshopt.h"
+#include "teapot.h"
+#include "vboplane.h"
+#include "vbosphere.h"
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QDebug>
+
+#include <cmath>
+#include <cstring>
+
+// Best of n constructions, in milliseconds
+static double timeTeapot(int grid, bool parallel, bool simd, int repeats)
+{
+    double best = -1.0;
+    for (int r = 0; r < repeats; r++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        Teapot teapot(grid, QMatrix4x4(), parallel, simd);
+        double ms = timer.nsecsElapsed() / 1.0e6;
+
+        if (best < 0.0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+static bool sameTeapot(Teapot &a, Teapot &b)
+{
+    int nVerts = a.getnVerts();
+    int nElems = a.getnElems();
+
+    return nVerts == b.getnVerts() && nElems == b.getnElems()
+        && std::memcmp(a.getv(),  b.getv(),  3 * nVerts * sizeof(float)) == 0
+        && std::memcmp(a.getn(),  b.getn(),  3 * nVerts * sizeof(float)) == 0
+        && std::memcmp(a.gettc(), b.gettc(), 2 * nVerts * sizeof(float)) == 0
+        && std::memcmp(a.getelems(), b.getelems(), nElems * sizeof(unsigned int)) == 0;
+}
+
+QString MeshBench::tessellation(const QList<int> &grids, int repeats, bool csv)
+{
+    QString report;
+    QTextStream out(&report);
+    QJsonArray runs;
+
+    int threads = QThreadPool::globalInstance()->maxThreadCount();
+
+    if (csv)
+        out << "grid,vertices,threads,serial_ms,parallel_ms,speedup,identical\n";
+
+    foreach (int grid, grids)
+    {
+        bool identical;
+        {
+            Teapot serial(grid, QMatrix4x4(), false);
+            Teapot parallel(grid, QMatrix4x4(), true);
+            identical = sameTeapot(serial, parallel);
+        }
+        if (!identical)
+            qWarning() << "teapot grid" << grid << ": parallel build differs from serial";
+
+        double serialMs   = timeTeapot(grid, false, true, repeats);
+        double parallelMs = timeTeapot(grid, true, true, repeats);
+        double speedup    = parallelMs > 0.0 ? serialMs / parallelMs : 0.0;
+        int    vertices   = 32 * (grid + 1) * (grid + 1);
+
+        qDebug() << "teapot grid" << grid << "serial" << serialMs << "ms parallel" << parallelMs << "ms";
+
+        if (csv) {
+            out << grid << "," << vertices << "," << threads << "," << serialMs << ","
+                << parallelMs << "," << speedup << "," << (identical ? 1 : 0) << "\n";
+        } else {
+            QJsonObject run;
+            run["grid"]        = grid;
+            run["vertices"]    = vertices;
+            run["threads"]     = threads;
+            run["serial_ms"]   = serialMs;
+            run["parallel_ms"] = parallelMs;
+            run["speedup"]     = speedup;
+            run["identical"]   = identical;
+            runs.append(run);
+        }
+    }
+
+    if (!csv) {
+        QJsonObject root;
+        root["tessellation"] = runs;
+        out << QJsonDocument(root).toJson();
+    }
+    out.flush();
+
+    return report;
+}
+
+static double maxDifference(const float *a, const float *b, int n)
+{
+    double diff = 0.0;
+    for (int i = 0; i < n; i++)
+        diff = qMax(diff, (double)std::fabs(a[i] - b[i]));
+    return diff;
+}
+
+QString MeshBench::bezier(const QList<int> &grids, int repeats, bool csv)
+{
+    QString report;
+    QTextStream out(&report);
+    QJsonArray runs;
+
+    if (csv)
+        out << "grid,vertices,scalar_ms,simd_ms,speedup,max_pos_diff,max_normal_diff\n";
+
+    foreach (int grid, grids)
+    {
+        double posDiff, normDiff;
+        {
+            Teapot scalar(grid, QMatrix4x4(), false, false);
+            Teapot simd(grid, QMatrix4x4(), false, true);
+            posDiff  = maxDifference(scalar.getv(), simd.getv(), 3 * scalar.getnVerts());
+            normDiff = maxDifference(scalar.getn(), simd.getn(), 3 * scalar.getnVerts());
+        }
+
+        double scalarMs = timeTeapot(grid, false, false, repeats);
+        double simdMs   = timeTeapot(grid, false, true, repeats);
+        double speedup  = simdMs > 0.0 ? scalarMs / simdMs : 0.0;
+        int    vertices = 32 * (grid + 1) * (grid + 1);
+
+        qDebug() << "teapot grid" << grid << "scalar" << scalarMs << "ms simd" << simdMs << "ms";
+
+        if (csv) {
+            out << grid << "," << vertices << "," << scalarMs << "," << simdMs << ","
+                << speedup << "," << posDiff << "," << normDiff << "\n";
+        } else {
+            QJsonObject run;
+            run["grid"]            = grid;
+            run["vertices"]        = vertices;
+            run["scalar_ms"]       = scalarMs;
+            run["simd_ms"]         = simdMs;
+            run["speedup"]         = speedup;
+            run["max_pos_diff"]    = posDiff;
+            run["max_normal_diff"] = normDiff;
+            runs.append(run);
+        }
+    }
+
+    if (!csv) {
+        QJsonObject root;
+        root["bezier"] = runs;
+        out << QJsonDocument(root).toJson();
+    }
+    out.flush();
+
+    return report;
+}
+
+struct StripRun
+{
+    const char *mesh;
+    int         size;
+    int         vertices;
+    int         listIndices, stripIndices;
+    CacheStats  list, listOptimized, strip;
+};
+
+static StripRun compareStrips(const char *mesh, int size, const MeshData &list, const MeshData &strip)
+{
+    StripRun run;
+    run.mesh         = mesh;
+    run.size         = size;
+    run.vertices     = list.vertexCount();
+    run.listIndices  = list.indexCount();
+    run.stripIndices = strip.indexCount();
+
+    run.list  = MeshOptimizer::analyzeCache(list.indices(), run.listIndices, run.vertices);
+    run.strip = MeshOptimizer::analyzeStripCache(strip.indices(), run.stripIndices, run.vertices);
+
+    QVector<unsigned int> ordered(run.listIndices);
+    std::memcpy(ordered.data(), list.indices(), run.listIndices * sizeof(unsigned int));
+    MeshOptimizer::optimizeVertexCache(ordered.data(), run.listIndices, run.vertices);
+    run.listOptimized = MeshOptimizer::analyzeCache(ordered.constData(), run.listIndices, run.vertices);
+
+    return run;
+}
+
+QString MeshBench::strips(const QList<int> &grids, bool csv)
+{
+    QString report;
+    QTextStream out(&report);
+    QJsonArray runs;
+
+    if (csv)
+        out << "mesh,size,vertices,list_indices,strip_indices,list_bytes,strip_bytes,index_saving,"
+               "list_triangles,strip_triangles,list_fetches,list_opt_fetches,strip_fetches\n";
+
+    foreach (int grid, grids)
+    {
+        QList<StripRun> meshRuns;
+        {
+            Teapot list(grid, QMatrix4x4(), true, true, false);
+            Teapot strip(grid, QMatrix4x4(), true, true, true);
+            meshRuns << compareStrips("teapot", grid, list.takeData(), strip.takeData());
+        }
+        {
+            VBOSphere list(2.0f, grid, grid, false);
+            VBOSphere strip(2.0f, grid, grid, true);
+            meshRuns << compareStrips("sphere", grid, list.takeData(), strip.takeData());
+        }
+        {
+            VBOPlane list(20.0f, 10.0f, grid, grid, 1.0f, 1.0f, false);
+            VBOPlane strip(20.0f, 10.0f, grid, grid, 1.0f, 1.0f, true);
+            meshRuns << compareStrips("plane", grid, list.takeData(), strip.takeData());
+        }
+
+        foreach (const StripRun &r, meshRuns)
+        {
+            // 32-bit, as the float layout uploads them; the packed layout
+            // halves both below 65536 vertices
+            qint64 listBytes  = qint64(r.listIndices) * sizeof(unsigned int);
+            qint64 stripBytes = qint64(r.stripIndices) * sizeof(unsigned int);
+            double saving     = listBytes > 0 ? 1.0 - double(stripBytes) / listBytes : 0.0;
+
+            qDebug() << r.mesh << r.size << ":" << r.listIndices << "list indices," << r.stripIndices
+                     << "in strips; vertex fetches" << r.list.misses << "list," << r.listOptimized.misses
+                     << "optimized list," << r.strip.misses << "strips";
+
+            if (csv) {
+                out << r.mesh << "," << r.size << "," << r.vertices << "," << r.listIndices << ","
+                    << r.stripIndices << "," << listBytes << "," << stripBytes << "," << saving << ","
+                    << r.list.triangles << "," << r.strip.triangles << "," << r.list.misses << ","
+                    << r.listOptimized.misses << "," << r.strip.misses << "\n";
+            } else {
+                QJsonObject run;
+                run["mesh"]             = r.mesh;
+                run["size"]             = r.size;
+                run["vertices"]         = r.vertices;
+                run["list_indices"]     = r.listIndices;
+                run["strip_indices"]    = r.stripIndices;
+                run["list_bytes"]       = double(listBytes);
+                run["strip_bytes"]      = double(stripBytes);
+                run["index_saving"]     = saving;
+                run["list_triangles"]   = double(r.list.triangles);
+                run["strip_triangles"]  = double(r.strip.triangles);
+                run["list_fetches"]     = double(r.list.misses);
+                run["list_opt_fetches"] = double(r.listOptimized.misses);
+                run["strip_fetches"]    = double(r.strip.misses);
+                run["list_acmr"]        = r.list.acmr();
+                run["list_opt_acmr"]    = r.listOptimized.acmr();
+                run["strip_acmr"]       = r.strip.acmr();
+                runs.append(run);
+            }
+        }
+    }
+
+    if (!csv) {
+        QJsonObject root;
+        root["strips"] = runs;
+        out << QJsonDocument(root).toJson();
+    }
+    out.flush();
+
+    return report;
+}
@@ -0,0 +1,28 @@
+#ifndef MESHBENCH_H
+#define MESHBENCH_H
+
+#include <QList>
+#include <QString>
+
+// CPU-side geometry benchmarks, no GL context needed
+class MeshBench
+{
+public:
+    // Teapot tessellation, serial against the thread pool, at each grid size.
+    // Also checks that both builds produce byte-identical arrays.
+    static QString tessellation(const QList<int> &grids, int repeats, bool csv);
+
+    // Teapot patch evaluation, QVector3D scalar path against the SIMD row
+    // evaluator, both serial. Reports the largest position/normal difference.
+    static QString bezier(const QList<int> &grids, int repeats, bool csv);
+
+    // Index buffers of the teapot, sphere and plane as triangle lists and
+    // as strips joined by primitive restart, at each grid size (teapot
+    // grid, sphere slices and stacks, plane divisions). Reports index
+    // bytes and the vertex fetches of a simulated 16-entry FIFO cache for
+    // the list in generation order, the list after the cache optimizer,
+    // and the strips.
+    static QString strips(const QList<int> &grids, bool csv);
+};
+
+#endif // MESHBENCH_H
@@ -0,0 +1,128 @@
+#include "bezier.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BEZIER_SSE
+#endif
+
+BezierRowEvaluator::BezierRowEvaluator(const float *B, const float *dB, int grid)
+    : mCount(grid + 1)
+{
+    // Pad rows to a multiple of 4 so the SIMD loop needs no tail
+    mStride = (mCount + 3) & ~3;
+
+    mBu.assign(B, B + 4 * mCount);
+    mdBu.assign(dB, dB + 4 * mCount);
+
+    mBv.assign(4 * mStride, 0.0f);
+    mdBv.assign(4 * mStride, 0.0f);
+    for (int k = 0; k < mCount; k++) {
+        for (int j = 0; j < 4; j++) {
+            mBv[j * mStride + k]  = B[k * 4 + j];
+            mdBv[j * mStride + k] = dB[k * 4 + j];
+        }
+    }
+}
+
+void BezierRowEvaluator::evaluateRow(const float cp[3][16], int gridU, float sx, float sy, bool invertNormal,
+                                     float *pos, float *norm) const
+{
+    const float *bu  = &mBu[gridU * 4];
+    const float *dbu = &mdBu[gridU * 4];
+
+    // Collapse the u direction: four curve control points and their u tangents
+    float q[3][4], dq[3][4];
+    for (int c = 0; c < 3; c++) {
+        for (int j = 0; j < 4; j++) {
+            q[c][j]  = bu[0]  * cp[c][j] + bu[1]  * cp[c][4 + j] + bu[2]  * cp[c][8 + j] + bu[3]  * cp[c][12 + j];
+            dq[c][j] = dbu[0] * cp[c][j] + dbu[1] * cp[c][4 + j] + dbu[2] * cp[c][8 + j] + dbu[3] * cp[c][12 + j];
+        }
+    }
+
+    const float *b0 = &mBv[0],  *b1 = &mBv[mStride],  *b2 = &mBv[2 * mStride],  *b3 = &mBv[3 * mStride];
+    const float *d0 = &mdBv[0], *d1 = &mdBv[mStride], *d2 = &mdBv[2 * mStride], *d3 = &mdBv[3 * mStride];
+
+    float nsign = invertNormal ? -1.0f : 1.0f;
+
+#ifdef BEZIER_SSE
+    __m128 q0[3], q1[3], q2[3], q3[3], dq0[3], dq1[3], dq2[3], dq3[3];
+    for (int c = 0; c < 3; c++) {
+        q0[c]  = _mm_set1_ps(q[c][0]);  q1[c]  = _mm_set1_ps(q[c][1]);
+        q2[c]  = _mm_set1_ps(q[c][2]);  q3[c]  = _mm_set1_ps(q[c][3]);
+        dq0[c] = _mm_set1_ps(dq[c][0]); dq1[c] = _mm_set1_ps(dq[c][1]);
+        dq2[c] = _mm_set1_ps(dq[c][2]); dq3[c] = _mm_set1_ps(dq[c][3]);
+    }
+    const __m128 tiny = _mm_set1_ps(1.0e-12f);
+
+    for (int k = 0; k < mStride; k += 4) {
+        __m128 vb0 = _mm_loadu_ps(b0 + k), vb1 = _mm_loadu_ps(b1 + k);
+        __m128 vb2 = _mm_loadu_ps(b2 + k), vb3 = _mm_loadu_ps(b3 + k);
+        __m128 vd0 = _mm_loadu_ps(d0 + k), vd1 = _mm_loadu_ps(d1 + k);
+        __m128 vd2 = _mm_loadu_ps(d2 + k), vd3 = _mm_loadu_ps(d3 + k);
+
+        // SoA results of these four points: x, y, z, then the normal
+        float out[6][4];
+
+        __m128 du[3], dv[3];
+        for (int c = 0; c < 3; c++) {
+            __m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vb0, q0[c]), _mm_mul_ps(vb1, q1[c])),
+                                  _mm_add_ps(_mm_mul_ps(vb2, q2[c]), _mm_mul_ps(vb3, q3[c])));
+            _mm_storeu_ps(out[c], p);
+
+            du[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vb0, dq0[c]), _mm_mul_ps(vb1, dq1[c])),
+                               _mm_add_ps(_mm_mul_ps(vb2, dq2[c]), _mm_mul_ps(vb3, dq3[c])));
+            dv[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vd0, q0[c]), _mm_mul_ps(vd1, q1[c])),
+                               _mm_add_ps(_mm_mul_ps(vd2, q2[c]), _mm_mul_ps(vd3, q3[c])));
+        }
+
+        // n = normalize(du x dv), zero where the patch is degenerate
+        __m128 nx = _mm_sub_ps(_mm_mul_ps(du[1], dv[2]), _mm_mul_ps(du[2], dv[1]));
+        __m128 ny = _mm_sub_ps(_mm_mul_ps(du[2], dv[0]), _mm_mul_ps(du[0], dv[2]));
+        __m128 nz = _mm_sub_ps(_mm_mul_ps(du[0], dv[1]), _mm_mul_ps(du[1], dv[0]));
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+        __m128 valid = _mm_cmpgt_ps(len2, tiny);
+        __m128 inv = _mm_and_ps(valid, _mm_div_ps(_mm_set1_ps(nsign), _mm_sqrt_ps(_mm_max_ps(len2, tiny))));
+
+        _mm_storeu_ps(out[3], _mm_mul_ps(nx, inv));
+        _mm_storeu_ps(out[4], _mm_mul_ps(ny, inv));
+        _mm_storeu_ps(out[5], _mm_mul_ps(nz, inv));
+
+        // Back to the interleaved layout of the mesh arrays, reflecting on
+        // the way; the padding past mCount is dropped
+        for (int i = 0; i < 4 && k + i < mCount; i++) {
+            float *p = pos + 3 * (k + i), *n = norm + 3 * (k + i);
+            p[0] = sx * out[0][i];
+            p[1] = sy * out[1][i];
+            p[2] = out[2][i];
+            n[0] = sx * out[3][i];
+            n[1] = sy * out[4][i];
+            n[2] = out[5][i];
+        }
+    }
+#else
+    for (int k = 0; k < mCount; k++) {
+        float p[3], du[3], dv[3];
+        for (int c = 0; c < 3; c++) {
+            p[c]  = b0[k] * q[c][0] + b1[k] * q[c][1] + b2[k] * q[c][2] + b3[k] * q[c][3];
+            du[c] = b0[k] * dq[c][0] + b1[k] * dq[c][1] + b2[k] * dq[c][2] + b3[k] * dq[c][3];
+            dv[c] = d0[k] * q[c][0]  + d1[k] * q[c][1]  + d2[k] * q[c][2]  + d3[k] * q[c][3];
+        }
+
+        float nx = du[1] * dv[2] - du[2] * dv[1];
+        float ny = du[2] * dv[0] - du[0] * dv[2];
+        float nz = du[0] * dv[1] - du[1] * dv[0];
+        float len2 = nx * nx + ny * ny + nz * nz;
+        float inv = len2 > 1.0e-12f ? nsign / std::sqrt(len2) : 0.0f;
+
+        // Interleaved like the mesh arrays, reflecting on the way
+        pos[3*k]      = sx * p[0];
+        pos[3*k + 1]  = sy * p[1];
+        pos[3*k + 2]  = p[2];
+        norm[3*k]     = sx * nx * inv;
+        norm[3*k + 1] = sy * ny * inv;
+        norm[3*k + 2] = nz * inv;
+    }
+#endif
+}
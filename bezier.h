@@ -0,0 +1,32 @@
+#ifndef BEZIER_H
+#define BEZIER_H
+
+#include <vector>
+
+// Evaluates bicubic Bezier patches one grid row at a time.
+//
+// The Bernstein tables are kept transposed (one array per basis function),
+// so for a fixed u the whole row of grid + 1 points is four multiply-adds
+// per coordinate over contiguous floats. The inner loops run four points at
+// a time with SSE when available, plain loops otherwise. Evaluation keeps no
+// state, so one evaluator serves every patch of a grid from any thread.
+class BezierRowEvaluator
+{
+public:
+    // B and dB are the interleaved tables of Teapot::computeBasisFunctions
+    BezierRowEvaluator(const float *B, const float *dB, int grid);
+
+    // cp holds the 16 control points as x[16], y[16], z[16], index u*4+v.
+    // Writes grid + 1 interleaved xyz positions and normals. The reflection
+    // is applied as sign flips of x and y (sx, sy = +-1).
+    void evaluateRow(const float cp[3][16], int gridU, float sx, float sy, bool invertNormal,
+                     float *pos, float *norm) const;
+
+private:
+    int mCount, mStride;
+
+    std::vector<float> mBu, mdBu;   // interleaved, per row
+    std::vector<float> mBv, mdBv;   // transposed, 4 arrays of mStride floats
+};
+
+#endif // BEZIER_H
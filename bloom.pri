@@ -0,0 +1,89 @@
+# Rendering code shared by the HDRToneMap application and the bench tool
+
+QT += gui core concurrent
+
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD
+
+# qmake CONFIG+=bloom_profile compiles in the PROFILE_ZONE scopes
+bloom_profile {
+    DEFINES += BLOOM_PROFILE
+}
+
+SOURCES += \
+    $$PWD/Bloom.cpp \
+    $$PWD/bezier.cpp \
+    $$PWD/bvh.cpp \
+    $$PWD/framescheduler.cpp \
+    $$PWD/gputimer.cpp \
+    $$PWD/meshcache.cpp \
+    $$PWD/meshdata.cpp \
+    $$PWD/meshlod.cpp \
+    $$PWD/meshopt.cpp \
+    $$PWD/offscreenrenderer.cpp \
+    $$PWD/overdrawcounter.cpp \
+    $$PWD/profiler.cpp \
+    $$PWD/renderqueue.cpp \
+    $$PWD/scene.cpp \
+    $$PWD/scenestate.cpp \
+    $$PWD/teapot.cpp \
+    $$PWD/transformbatch.cpp \
+    $$PWD/vboplane.cpp \
+    $$PWD/vbosphere.cpp \
+    $$PWD/vertexformat.cpp
+
+HEADERS += \
+    $$PWD/Bloom.h \
+    $$PWD/bezier.h \
+    $$PWD/bvh.h \
+    $$PWD/framescheduler.h \
+    $$PWD/gputimer.h \
+    $$PWD/meshcache.h \
+    $$PWD/meshdata.h \
+    $$PWD/meshlod.h \
+    $$PWD/meshopt.h \
+    $$PWD/offscreenrenderer.h \
+    $$PWD/overdrawcounter.h \
+    $$PWD/profiler.h \
+    $$PWD/renderqueue.h \
+    $$PWD/scene.h \
+    $$PWD/scenestate.h \
+    $$PWD/teapotdata.h \
+    $$PWD/teapot.h \
+    $$PWD/transformbatch.h \
+    $$PWD/vboplane.h \
+    $$PWD/vbosphere.h \
+    $$PWD/vertexformat.h
+
+OTHER_FILES += \
+    $$PWD/fshader.txt \
+    $$PWD/vshader.txt \
+    $$PWD/tessvshader.txt \
+    $$PWD/tcshader.txt \
+    $$PWD/teshader.txt \
+    $$PWD/depthfshader.txt \
+    $$PWD/clustercshader.txt \
+    $$PWD/gbufferfshader.txt \
+    $$PWD/deferredfshader.txt \
+    $$PWD/lighting.txt \
+    $$PWD/impostorvshader.txt \
+    $$PWD/impostorfshader.txt
+
+RESOURCES += \
+    $$PWD/shaders.qrc
+
+DISTFILES += \
+    $$PWD/scenes/room.json \
+    $$PWD/fshader.txt \
+    $$PWD/vshader.txt \
+    $$PWD/tessvshader.txt \
+    $$PWD/tcshader.txt \
+    $$PWD/teshader.txt \
+    $$PWD/depthfshader.txt \
+    $$PWD/clustercshader.txt \
+    $$PWD/gbufferfshader.txt \
+    $$PWD/deferredfshader.txt \
+    $$PWD/lighting.txt \
+    $$PWD/impostorvshader.txt \
+    $$PWD/impostorfshader.txt
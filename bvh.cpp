@@ -0,0 +1,253 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BVH_SSE
+#endif
+
+Aabb Aabb::transformed(const float *min, const float *max, const QMatrix4x4 &transform)
+{
+    // Centre moves with the transform, the half extents through |M|
+    float c[3], e[3];
+    for (int j = 0; j < 3; j++) {
+        c[j] = 0.5f * (min[j] + max[j]);
+        e[j] = 0.5f * (max[j] - min[j]);
+    }
+
+    Aabb box;
+    for (int i = 0; i < 3; i++) {
+        float center = transform(i, 3), extent = 0.0f;
+        for (int j = 0; j < 3; j++) {
+            center += transform(i, j) * c[j];
+            extent += std::fabs(transform(i, j)) * e[j];
+        }
+        box.min[i] = center - extent;
+        box.max[i] = center + extent;
+    }
+    return box;
+}
+
+Frustum::Frustum(const QMatrix4x4 &viewProjection)
+{
+    // Gribb-Hartmann: -w <= x, y, z <= w in clip space, a point is inside
+    // a plane (x, y, z, d) when x*px + y*py + z*pz + d >= 0
+    QVector4D r0 = viewProjection.row(0), r1 = viewProjection.row(1);
+    QVector4D r2 = viewProjection.row(2), r3 = viewProjection.row(3);
+    QVector4D planes[6] = { r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2 };
+
+    for (int i = 0; i < 8; i++) {
+        QVector4D p = i < 6 ? planes[i] : QVector4D(0.0f, 0.0f, 0.0f, 1.0f);
+        mX[i] = p.x();
+        mY[i] = p.y();
+        mZ[i] = p.z();
+        mD[i] = p.w();
+        mAbsX[i] = std::fabs(p.x());
+        mAbsY[i] = std::fabs(p.y());
+        mAbsZ[i] = std::fabs(p.z());
+    }
+}
+
+Frustum::Result Frustum::test(const Aabb &box) const
+{
+    float cx = 0.5f * (box.min[0] + box.max[0]), ex = 0.5f * (box.max[0] - box.min[0]);
+    float cy = 0.5f * (box.min[1] + box.max[1]), ey = 0.5f * (box.max[1] - box.min[1]);
+    float cz = 0.5f * (box.min[2] + box.max[2]), ez = 0.5f * (box.max[2] - box.min[2]);
+
+    // Distance of the centre to each plane, and how far the box reaches
+    // towards it: outside if d + r < 0 for one plane, inside if d - r >= 0
+    // for all of them
+#ifdef BVH_SSE
+    __m128 vcx = _mm_set1_ps(cx), vcy = _mm_set1_ps(cy), vcz = _mm_set1_ps(cz);
+    __m128 vex = _mm_set1_ps(ex), vey = _mm_set1_ps(ey), vez = _mm_set1_ps(ez);
+    __m128 outside = _mm_setzero_ps(), intersect = _mm_setzero_ps();
+    for (int k = 0; k < 8; k += 4) {
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(mX + k), vcx),
+                                         _mm_mul_ps(_mm_loadu_ps(mY + k), vcy)),
+                              _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(mZ + k), vcz), _mm_loadu_ps(mD + k)));
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(mAbsX + k), vex),
+                                         _mm_mul_ps(_mm_loadu_ps(mAbsY + k), vey)),
+                              _mm_mul_ps(_mm_loadu_ps(mAbsZ + k), vez));
+        outside   = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        intersect = _mm_or_ps(intersect, _mm_cmplt_ps(_mm_sub_ps(d, r), _mm_setzero_ps()));
+    }
+    if (_mm_movemask_ps(outside) != 0)
+        return Outside;
+    return _mm_movemask_ps(intersect) != 0 ? Intersecting : Inside;
+#else
+    Result result = Inside;
+    for (int i = 0; i < 6; i++) {
+        float d = mX[i] * cx + mY[i] * cy + mZ[i] * cz + mD[i];
+        float r = mAbsX[i] * ex + mAbsY[i] * ey + mAbsZ[i] * ez;
+        if (d + r < 0.0f)
+            return Outside;
+        if (d - r < 0.0f)
+            result = Intersecting;
+    }
+    return result;
+#endif
+}
+
+Bvh::Bvh()
+    : mNodeTests(0)
+{
+}
+
+void Bvh::build(const QVector<Aabb> &bounds)
+{
+    mNodes.clear();
+    mObjects.resize(bounds.size());
+    mLeafOf.resize(bounds.size());
+    if (bounds.isEmpty())
+        return;
+
+    QVector<float> centers(3 * bounds.size());
+    for (int i = 0; i < bounds.size(); i++) {
+        mObjects[i] = i;
+        for (int c = 0; c < 3; c++)
+            centers[3*i + c] = 0.5f * (bounds[i].min[c] + bounds[i].max[c]);
+    }
+
+    mNodes.reserve(2 * (bounds.size() / LeafSize + 1));
+    buildNode(bounds, centers, 0, bounds.size(), -1);
+}
+
+int Bvh::buildNode(const QVector<Aabb> &bounds, const QVector<float> &centers,
+                   int first, int count, int parent)
+{
+    int index = mNodes.size();
+    Node node;
+    node.parent = parent;
+    node.left   = node.right = -1;
+    node.first  = first;
+    node.count  = count;
+    mNodes << node;
+
+    if (count <= LeafSize) {
+        for (int i = first; i < first + count; i++)
+            mLeafOf[mObjects[i]] = index;
+        updateBox(index, bounds);
+        return index;
+    }
+
+    // Split at the median centre along the longest axis of the centres
+    float lo[3], hi[3];
+    for (int c = 0; c < 3; c++)
+        lo[c] = hi[c] = centers[3 * mObjects[first] + c];
+    for (int i = first + 1; i < first + count; i++)
+        for (int c = 0; c < 3; c++) {
+            lo[c] = qMin(lo[c], centers[3 * mObjects[i] + c]);
+            hi[c] = qMax(hi[c], centers[3 * mObjects[i] + c]);
+        }
+    int axis = 0;
+    for (int c = 1; c < 3; c++)
+        if (hi[c] - lo[c] > hi[axis] - lo[axis])
+            axis = c;
+
+    int half = count / 2;
+    const float *cs = centers.constData();
+    std::nth_element(mObjects.begin() + first, mObjects.begin() + first + half, mObjects.begin() + first + count,
+                     [cs, axis](int a, int b) { return cs[3*a + axis] < cs[3*b + axis]; });
+
+    int left  = buildNode(bounds, centers, first, half, index);
+    int right = buildNode(bounds, centers, first + half, count - half, index);
+    mNodes[index].left  = left;
+    mNodes[index].right = right;
+    updateBox(index, bounds);
+
+    return index;
+}
+
+// Recomputes the box of one node from its objects or children, true if
+// it changed
+bool Bvh::updateBox(int index, const QVector<Aabb> &bounds)
+{
+    Node &node = mNodes[index];
+    Aabb box;
+    if (node.left < 0) {
+        box = bounds[mObjects[node.first]];
+        for (int i = node.first + 1; i < node.first + node.count; i++)
+            for (int c = 0; c < 3; c++) {
+                box.min[c] = qMin(box.min[c], bounds[mObjects[i]].min[c]);
+                box.max[c] = qMax(box.max[c], bounds[mObjects[i]].max[c]);
+            }
+    } else {
+        const Aabb &a = mNodes[node.left].box, &b = mNodes[node.right].box;
+        for (int c = 0; c < 3; c++) {
+            box.min[c] = qMin(a.min[c], b.min[c]);
+            box.max[c] = qMax(a.max[c], b.max[c]);
+        }
+    }
+
+    bool changed = false;
+    for (int c = 0; c < 3; c++)
+        changed = changed || box.min[c] != node.box.min[c] || box.max[c] != node.box.max[c];
+    node.box = box;
+    return changed;
+}
+
+void Bvh::refit(const QVector<Aabb> &bounds, const QVector<int> &moved)
+{
+    // Walk up from each moved object until a box stays the same; nodes
+    // above an unchanged box cannot change because of it
+    for (int i = 0; i < moved.size(); i++) {
+        int node = mLeafOf[moved[i]];
+        while (node >= 0 && updateBox(node, bounds))
+            node = mNodes[node].parent;
+    }
+}
+
+static float area(const Aabb &box)
+{
+    float dx = box.max[0] - box.min[0], dy = box.max[1] - box.min[1], dz = box.max[2] - box.min[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+float Bvh::cost() const
+{
+    if (mNodes.isEmpty())
+        return 0.0f;
+
+    // A root without area, every box in one plane, weighs nodes alike
+    float root = area(mNodes[0].box);
+    float sum = 0.0f;
+    for (int i = 0; i < mNodes.size(); i++) {
+        const Node &node = mNodes[i];
+        float tests = node.left < 0 ? 1.0f + node.count : 1.0f;
+        sum += tests * (root > 0.0f ? area(node.box) / root : 1.0f);
+    }
+    return sum;
+}
+
+void Bvh::cull(const Frustum &frustum, const QVector<Aabb> &bounds, QVector<int> &visible)
+{
+    mNodeTests = 0;
+    if (mNodes.isEmpty())
+        return;
+
+    mStack.clear();
+    mStack << 0;
+    while (!mStack.isEmpty()) {
+        const Node &node = mNodes[mStack.takeLast()];
+        mNodeTests++;
+
+        Frustum::Result result = frustum.test(node.box);
+        if (result == Frustum::Outside)
+            continue;
+
+        if (result == Frustum::Inside) {
+            for (int i = node.first; i < node.first + node.count; i++)
+                visible << mObjects[i];
+        } else if (node.left < 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                mNodeTests++;
+                if (frustum.test(bounds[mObjects[i]]) != Frustum::Outside)
+                    visible << mObjects[i];
+            }
+        } else {
+            mStack << node.right << node.left;
+        }
+    }
+}
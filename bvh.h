@@ -0,0 +1,88 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <QVector>
+#include <QMatrix4x4>
+
+// Axis-aligned box
+struct Aabb
+{
+    float min[3], max[3];
+
+    // The box around this one, an object-space box, after transform
+    static Aabb transformed(const float *min, const float *max, const QMatrix4x4 &transform);
+};
+
+// The six planes of a view frustum as extracted from a view-projection
+// matrix, stored coordinate-major so one SSE instruction handles four
+// planes. Two padding planes always pass.
+class Frustum
+{
+public:
+    enum Result { Outside, Intersecting, Inside };
+
+    explicit Frustum(const QMatrix4x4 &viewProjection);
+
+    Result test(const Aabb &box) const;
+
+private:
+    float mX[8], mY[8], mZ[8], mD[8];
+    float mAbsX[8], mAbsY[8], mAbsZ[8];
+};
+
+// Bounding volume hierarchy over the world-space boxes of scene objects.
+// Built top-down with median splits on the longest axis; when objects
+// move, refit() grows or shrinks only the boxes above them, keeping the
+// tree shape. Every node covers a contiguous range of object indices, so
+// a node fully inside the frustum is taken without visiting its children.
+class Bvh
+{
+public:
+    enum { LeafSize = 4 };
+
+    Bvh();
+
+    void build(const QVector<Aabb> &bounds);
+    void refit(const QVector<Aabb> &bounds, const QVector<int> &moved);
+
+    // Appends the objects whose boxes are not outside the frustum
+    void cull(const Frustum &frustum, const QVector<Aabb> &bounds, QVector<int> &visible);
+
+    bool isEmpty() const    { return mNodes.isEmpty(); }
+    int  nodeCount() const  { return mNodes.size(); }
+    int  nodeTests() const  { return mNodeTests; }   // node and object boxes, last cull()
+
+    // Surface area cost: the box tests expected of a query that hits the
+    // root, each node weighted by its area over the root's. A refit keeps
+    // the tree shape, so its cost drifts above that of a fresh build.
+    float cost() const;
+
+private:
+    struct Node
+    {
+        Aabb box;
+        int  parent;
+        int  left, right;     // children, -1 for a leaf
+        int  first, count;    // range in mObjects
+    };
+
+    int  buildNode(const QVector<Aabb> &bounds, const QVector<float> &centers,
+                   int first, int count, int parent);
+    bool updateBox(int node, const QVector<Aabb> &bounds);
+
+    QVector<Node> mNodes;
+    QVector<int>  mObjects;   // object indices, grouped by node
+    QVector<int>  mLeafOf;    // per object
+    QVector<int>  mStack;
+    int           mNodeTests;
+};
+
+// A refitted tree against one built from scratch over the same boxes
+struct BvhComparison
+{
+    float  refitCost, rebuildCost;     // Bvh::cost()
+    int    refitTests, rebuildTests;   // box tests of one cull
+    qint64 rebuildNs;
+};
+
+#endif // BVH_H
@@ -0,0 +1,100 @@
+#include "framescheduler.h"
+
+#include <cmath>
+
+FrameScheduler::FrameScheduler(Mode mode)
+    : mMode(mode), mRefreshMs(1000.0 / 60.0), mFixedStep(1.0 / 60.0),
+      mFrameIndex(0), mLastBeginNs(-1)
+{
+    mClock.start();
+    resetStats();
+}
+
+FrameScheduler::Mode FrameScheduler::modeFromString(const QString &name, bool *ok)
+{
+    if (ok) *ok = true;
+
+    if (name == "vsync")    return VsyncPaced;
+    if (name == "uncapped") return Uncapped;
+    if (name == "fixed")    return FixedTimestep;
+
+    if (ok) *ok = false;
+    return VsyncPaced;
+}
+
+QString FrameScheduler::modeName(Mode mode)
+{
+    switch (mode) {
+        case VsyncPaced:    return "vsync";
+        case Uncapped:      return "uncapped";
+        case FixedTimestep: return "fixed";
+    }
+    return QString();
+}
+
+void FrameScheduler::setMode(Mode mode)
+{
+    mMode = mode;
+    resetStats();
+}
+
+void FrameScheduler::setRefreshRate(double hz)
+{
+    if (hz > 0.0)
+        mRefreshMs = 1000.0 / hz;
+}
+
+double FrameScheduler::beginFrame()
+{
+    qint64 nowNs = mClock.nsecsElapsed();
+
+    if (mLastBeginNs >= 0) {
+        double intervalMs = (nowNs - mLastBeginNs) / 1.0e6;
+
+        mFrames++;
+        mSumMs += intervalMs;
+        mMaxMs  = qMax(mMaxMs, intervalMs);
+
+        // Refreshes that went by without a new frame
+        if (mMode != Uncapped && intervalMs > 1.5 * mRefreshMs)
+            mMissed += (qint64)std::floor(intervalMs / mRefreshMs + 0.5) - 1;
+    }
+    mLastBeginNs = nowNs;
+
+    if (mMode == FixedTimestep)
+        return mFrameIndex * mFixedStep;
+
+    return nowNs / 1.0e9;
+}
+
+void FrameScheduler::endFrame()
+{
+    mFrameIndex++;
+}
+
+FrameScheduler::Stats FrameScheduler::stats() const
+{
+    Stats st;
+    st.frames = mFrames;
+    st.missed = mMissed;
+    st.avgMs  = mFrames > 0 ? mSumMs / mFrames : 0.0;
+    st.maxMs  = mMaxMs;
+
+    return st;
+}
+
+QString FrameScheduler::summary() const
+{
+    Stats st = stats();
+
+    return QString("frames (%1): %2 missed %3 avg %4 ms max %5 ms")
+            .arg(modeName(mMode)).arg(st.frames).arg(st.missed)
+            .arg(st.avgMs, 0, 'f', 2).arg(st.maxMs, 0, 'f', 2);
+}
+
+void FrameScheduler::resetStats()
+{
+    mFrames = mMissed = 0;
+    mSumMs  = mMaxMs  = 0.0;
+    mLastBeginNs = -1;
+}
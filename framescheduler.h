@@ -0,0 +1,62 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QString>
+#include <QElapsedTimer>
+
+// Decides when frames start and what simulation time they show.
+//
+// VsyncPaced    - one frame per display refresh, wall clock time
+// Uncapped      - frames as fast as possible (swap interval 0), wall clock time
+// FixedTimestep - one frame per display refresh, time advances by a fixed step
+//                 per frame regardless of how long the frame took
+//
+// All modes use the monotonic clock behind QElapsedTimer and count a frame
+// as missed when it started more than half a refresh interval late.
+class FrameScheduler
+{
+public:
+    enum Mode { VsyncPaced, Uncapped, FixedTimestep };
+
+    struct Stats
+    {
+        qint64 frames;
+        qint64 missed;
+        double avgMs, maxMs;
+    };
+
+    explicit FrameScheduler(Mode mode = VsyncPaced);
+
+    static Mode    modeFromString(const QString &name, bool *ok = 0);
+    static QString modeName(Mode mode);
+
+    Mode mode() const { return mMode; }
+    void setMode(Mode mode);
+
+    void setRefreshRate(double hz);
+    void setFixedStep(double seconds) { mFixedStep = seconds; }
+
+    // Swap interval the surface format should request for this mode
+    int swapInterval() const { return mMode == Uncapped ? 0 : 1; }
+
+    double beginFrame();   // simulation time of the frame, in seconds
+    void   endFrame();
+
+    Stats   stats() const;
+    QString summary() const;
+    void    resetStats();
+
+private:
+    Mode   mMode;
+    double mRefreshMs;
+    double mFixedStep;
+
+    QElapsedTimer mClock;
+    qint64 mFrameIndex;
+    qint64 mLastBeginNs;
+
+    qint64 mFrames, mMissed;
+    double mSumMs, mMaxMs;
+};
+
+#endif // FRAMESCHEDULER_H
@@ -0,0 +1,157 @@
+#include "gputimer.h"
+
+GpuTimer::GpuTimer(int nIntervals, int ringSize, int window)
+    : mFuncs(0), mIntervals(nIntervals), mRingSize(ringSize), mWindow(window),
+      mFrame(0), mSlot(0), mRecording(false)
+{
+    mSamples.resize(mIntervals + 1);
+    mNext.fill(0, mIntervals + 1);
+}
+
+void GpuTimer::initialize(QOpenGLFunctions_4_3_Core *funcs)
+{
+    mFuncs = funcs;
+
+    mQueries.resize(mRingSize * (mIntervals + 1));
+    mFuncs->glGenQueries(mQueries.size(), mQueries.data());
+    mPending.fill(false, mRingSize);
+    mSlotOrder.fill(0, mRingSize);
+}
+
+void GpuTimer::destroy()
+{
+    if (mFuncs != 0 && !mQueries.isEmpty())
+        mFuncs->glDeleteQueries(mQueries.size(), mQueries.data());
+    mQueries.clear();
+    mFuncs = 0;
+}
+
+void GpuTimer::beginFrame()
+{
+    if (mFuncs == 0)
+        return;
+
+    collect();
+
+    mSlot = mFrame % mRingSize;
+    mFrame++;
+
+    // Still waiting on this slot from mRingSize frames ago: skip timing
+    mRecording = !mPending[mSlot];
+    if (mRecording)
+        mFuncs->glQueryCounter(mQueries[mSlot * (mIntervals + 1)], GL_TIMESTAMP);
+}
+
+void GpuTimer::mark(int interval)
+{
+    if (!mRecording)
+        return;
+
+    mFuncs->glQueryCounter(mQueries[mSlot * (mIntervals + 1) + interval + 1], GL_TIMESTAMP);
+}
+
+void GpuTimer::endFrame()
+{
+    if (!mRecording)
+        return;
+
+    mPending[mSlot]   = true;
+    mSlotOrder[mSlot] = mFrame;
+    mRecording = false;
+}
+
+void GpuTimer::collect(bool wait)
+{
+    if (mFuncs == 0)
+        return;
+
+    // Oldest frames first so the rolling windows stay in order
+    for (int n = 0; n < mRingSize; n++)
+    {
+        int slot = -1;
+        for (int s = 0; s < mRingSize; s++)
+            if (mPending[s] && (slot < 0 || mSlotOrder[s] < mSlotOrder[slot]))
+                slot = s;
+        if (slot < 0)
+            return;
+
+        GLuint *q = mQueries.data() + slot * (mIntervals + 1);
+
+        if (!wait) {
+            GLint available = 0;
+            mFuncs->glGetQueryObjectiv(q[mIntervals], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+        }
+
+        GLuint64 stamps[64];
+        int      nStamps = qMin(mIntervals + 1, 64);
+        for (int i = 0; i < nStamps; i++)
+            mFuncs->glGetQueryObjectui64v(q[i], GL_QUERY_RESULT, &stamps[i]);
+
+        for (int i = 0; i < nStamps - 1; i++)
+            addSample(i, (stamps[i+1] - stamps[i]) / 1.0e6);
+        addSample(mIntervals, (stamps[nStamps-1] - stamps[0]) / 1.0e6);
+
+        mPending[slot] = false;
+    }
+}
+
+void GpuTimer::reset()
+{
+    for (int i = 0; i <= mIntervals; i++) {
+        mSamples[i].clear();
+        mNext[i] = 0;
+    }
+}
+
+void GpuTimer::setWindow(int window)
+{
+    mWindow = qMax(1, window);
+    reset();
+}
+
+void GpuTimer::addSample(int interval, double ms)
+{
+    QVector<double> &s = mSamples[interval];
+
+    if (s.size() < mWindow) {
+        s.append(ms);
+    } else {
+        s[mNext[interval]] = ms;
+        mNext[interval] = (mNext[interval] + 1) % mWindow;
+    }
+}
+
+GpuTimer::Stats GpuTimer::stats(int interval) const
+{
+    Stats st = { 0.0, 0.0, 0.0, 0 };
+
+    const QVector<double> &s = mSamples[interval];
+    if (s.isEmpty())
+        return st;
+
+    st.minMs = st.maxMs = s[0];
+    double sum = 0.0;
+    for (int i = 0; i < s.size(); i++) {
+        st.minMs = qMin(st.minMs, s[i]);
+        st.maxMs = qMax(st.maxMs, s[i]);
+        sum += s[i];
+    }
+    st.avgMs   = sum / s.size();
+    st.samples = s.size();
+
+    return st;
+}
+
+QVector<double> GpuTimer::samples(int interval) const
+{
+    // Unroll the ring so the oldest sample comes first
+    const QVector<double> &s = mSamples[interval];
+    QVector<double> ordered;
+    ordered.reserve(s.size());
+    for (int i = 0; i < s.size(); i++)
+        ordered.append(s[(mNext[interval] + i) % s.size()]);
+
+    return ordered;
+}
@@ -0,0 +1,61 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <QVector>
+#include <QOpenGLFunctions_4_3_Core>
+
+// Per-pass GPU timing from glQueryCounter(GL_TIMESTAMP) markers.
+//
+// Each frame records nIntervals + 1 timestamps into one slot of a ring of
+// queries. Results are only read once GL_QUERY_RESULT_AVAILABLE says so,
+// a few frames later, so reading them never stalls the pipeline. If the GPU
+// falls so far behind that the slot is still pending, that frame is simply
+// not timed.
+class GpuTimer
+{
+public:
+    struct Stats
+    {
+        double minMs, avgMs, maxMs;
+        int    samples;
+    };
+
+    GpuTimer(int nIntervals, int ringSize = 5, int window = 120);
+
+    void initialize(QOpenGLFunctions_4_3_Core *funcs);
+    void destroy();
+
+    void beginFrame();
+    void mark(int interval);   // end of interval, start of interval + 1
+    void endFrame();
+
+    // Reads every finished slot; wait = true blocks until all are done
+    void collect(bool wait = false);
+    void reset();
+
+    int    intervals() const { return mIntervals; }
+    Stats  stats(int interval) const;
+    Stats  frameStats() const { return stats(mIntervals); }
+    QVector<double> samples(int interval) const;
+
+    void setWindow(int window);
+
+private:
+    void addSample(int interval, double ms);
+
+    QOpenGLFunctions_4_3_Core *mFuncs;
+
+    int mIntervals, mRingSize, mWindow;
+    int mFrame, mSlot;
+
+    QVector<GLuint> mQueries;   // mRingSize * (mIntervals + 1)
+    QVector<bool>   mPending;   // per slot
+    QVector<int>    mSlotOrder; // frame number recorded in each slot
+    bool            mRecording;
+
+    // Rolling window per interval, plus the whole frame at index mIntervals
+    QVector< QVector<double> > mSamples;
+    QVector<int>               mNext;
+};
+
+#endif // GPUTIMER_H
@@ -1,13 +1,193 @@
-#include "Bloom.h"
+#include "mywindow.h"
+#include "offscreenrenderer.h"
+#include "profiler.h"
 
 #include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QStandardPaths>
+
+#include <cstring>
+
+static bool hasArgument(int argc, char *argv[], const char *name)
+{
+    for (int i = 1; i < argc; i++)
+        if (std::strcmp(argv[i], name) == 0)
+            return true;
+    return false;
+}
+
+static QSize parseSize(const QString &text, const QSize &fallback)
+{
+    QStringList parts = text.split('x');
+    if (parts.size() != 2)
+        return fallback;
+
+    bool okW, okH;
+    int w = parts[0].toInt(&okW);
+    int h = parts[1].toInt(&okH);
+    if (!okW || !okH || w <= 0 || h <= 0)
+        return fallback;
+
+    return QSize(w, h);
+}
+
+static QString meshCacheDir(const QCommandLineParser &parser)
+{
+    if (parser.isSet("no-mesh-cache"))
+        return QString();
+    if (parser.isSet("mesh-cache"))
+        return parser.value("mesh-cache");
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/meshes";
+}
+
+// The scene file, a generated stress scene or the default room
+static bool loadScene(const QCommandLineParser &parser, SceneStore &scene)
+{
+    if (parser.isSet("scene")) {
+        if (!scene.load(parser.value("scene")))
+            return false;
+    } else if (parser.isSet("stress")) {
+        scene = SceneStore::stress(qMax(0, parser.value("stress").toInt()),
+                                   qMax(0, parser.value("stress-lights").toInt()));
+        qDebug() << "stress scene:" << scene.objectCount() << "objects," << scene.lightCount() << "lights";
+    } else {
+        scene = SceneStore::defaultScene();
+    }
+
+    if (parser.isSet("save-scene") && !scene.save(parser.value("save-scene"))) {
+        qWarning() << "Could not write" << parser.value("save-scene");
+        return false;
+    }
+    return true;
+}
+
+static int runHeadless(const QCommandLineParser &parser, const SceneStore &scene)
+{
+    QSize size   = parseSize(parser.value("size"), QSize(800, 600));
+    int   frames = qMax(1, parser.value("frames").toInt());
+    float step   = parser.value("time-step").toFloat();
+
+    OffscreenRenderer offscreen;
+    offscreen.renderer()->setPackedVertices(parser.isSet("packed-vertices"));
+    offscreen.renderer()->setOptimizeIndices(!parser.isSet("no-index-opt"));
+    offscreen.renderer()->setWeldTeapot(parser.isSet("weld"));
+    offscreen.renderer()->setTriangleStrips(parser.isSet("strips"));
+    offscreen.renderer()->setMeshCacheDir(meshCacheDir(parser));
+    offscreen.renderer()->setScene(scene);
+    if (!offscreen.create(size))
+        return 1;
+    offscreen.renderer()->setGpuStatsInterval(parser.value("gpu-stats").toInt() * 1000);
+    offscreen.renderer()->setGpuTessellation(parser.isSet("gpu-tess"));
+    offscreen.renderer()->setLodEnabled(!parser.isSet("no-lod"));
+    offscreen.renderer()->setIndirectDraws(parser.isSet("indirect"));
+    offscreen.renderer()->setFrustumCulling(!parser.isSet("no-cull"));
+    offscreen.renderer()->setDepthPrepass(BloomRenderer::depthPrepassFromString(parser.value("depth-prepass")));
+    offscreen.renderer()->setDepthPrepassThreshold(parser.value("depth-prepass-threshold").toFloat());
+    offscreen.renderer()->setOverdrawCounter(parser.isSet("overdraw"));
+    offscreen.renderer()->setDeferredShading(parser.isSet("deferred"));
+    offscreen.renderer()->setSphereImpostors(parser.isSet("impostors"));
+
+    for (int i = 0; i < frames; i++)
+        offscreen.renderFrame(i * step);
+
+    QString output = parser.value("output");
+    if (!output.isEmpty()) {
+        if (!offscreen.grabFrame().save(output)) {
+            qWarning() << "Could not write" << output;
+            return 1;
+        }
+        qDebug() << "wrote" << output;
+    }
+
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
+    // Headless runs must not need a display server
+    if (hasArgument(argc, argv, "--headless") && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
     QGuiApplication a(argc, argv);
 
-    MyWindow *window = new MyWindow();
-    window->show();
+    QCommandLineParser parser;
+    parser.setApplicationDescription("HDR tone mapping with bloom");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "headless",  "Render offscreen without a window." },
+        { "frames",    "Number of frames to render in headless mode.", "n", "1" },
+        { "size",      "Render target size in headless mode.", "WxH", "800x600" },
+        { "time-step", "Simulated seconds per frame in headless mode.", "s", "0.016667" },
+        { "output",    "Write the last headless frame to this image file.", "file" },
+        { "gpu-stats", "Print rolling GPU time per pass every n seconds.", "n" },
+        { "trace",     "Write profiling zones as Chrome trace JSON on exit.", "file" },
+        { "pacing",    "Frame pacing: vsync, uncapped or fixed.", "mode", "vsync" },
+        { "no-render-thread", "Render on the GUI thread." },
+        { "gpu-tess",  "Tessellate the teapot on the GPU." },
+        { "no-lod",    "Draw every mesh at its fixed base resolution." },
+        { "indirect",  "Draw the scene with one multi-draw-indirect call." },
+        { "no-cull",   "Draw every object, also those outside the view." },
+        { "depth-prepass", "Depth-only pass before lighting: off, on or auto.", "mode", "off" },
+        { "depth-prepass-threshold", "Depth complexity above which auto turns the pre-pass on.", "x", "1.5" },
+        { "overdraw",  "Count pass1 depth complexity with occlusion queries." },
+        { "deferred",  "Light pass1 from a G-buffer in one full-screen pass." },
+        { "impostors", "Draw spheres as instanced ray-cast impostors." },
+        { "packed-vertices", "Upload meshes in the packed interleaved vertex format." },
+        { "no-index-opt", "Upload the index buffers in generation order." },
+        { "weld",      "Weld the duplicated seam vertices of the teapot." },
+        { "strips",    "Upload meshes as triangle strips joined by primitive restart." },
+        { "mesh-cache", "Directory of the binary mesh cache, the user cache location by default.", "dir" },
+        { "no-mesh-cache", "Always generate the meshes." },
+        { "scene",     "Load objects, materials and lights from this JSON file.", "file" },
+        { "stress",    "Generate a scene of n teapots and spheres instead.", "n" },
+        { "stress-lights", "Lights of the generated scene.", "n", "8" },
+        { "save-scene", "Write the scene to this JSON file.", "file" },
+    });
+    parser.process(a);
+
+    if (parser.isSet("trace")) {
+        if (!Profiler::enabled())
+            qWarning( "Profiling zones are compiled out, rebuild with CONFIG+=bloom_profile" );
+        Profiler::dumpOnExit(parser.value("trace").toLocal8Bit().constData());
+    }
+
+    SceneStore scene;
+    if (!loadScene(parser, scene))
+        return 1;
+
+    bool prepassOk;
+    BloomRenderer::depthPrepassFromString(parser.value("depth-prepass"), &prepassOk);
+    if (!prepassOk)
+        qWarning() << "Unknown depth pre-pass mode" << parser.value("depth-prepass") << ", using off";
+
+    if (parser.isSet("headless"))
+        return runHeadless(parser, scene);
+
+    bool pacingOk;
+    FrameScheduler::Mode pacing = FrameScheduler::modeFromString(parser.value("pacing"), &pacingOk);
+    if (!pacingOk)
+        qWarning() << "Unknown pacing" << parser.value("pacing") << ", using vsync";
+
+    // Destroyed before the application so the render thread is joined cleanly
+    MyWindow window(pacing, !parser.isSet("no-render-thread"));
+    window.setGpuStatsInterval(parser.value("gpu-stats").toInt() * 1000);
+    window.setGpuTessellation(parser.isSet("gpu-tess"));
+    window.setLodEnabled(!parser.isSet("no-lod"));
+    window.setIndirectDraws(parser.isSet("indirect"));
+    window.setFrustumCulling(!parser.isSet("no-cull"));
+    window.setDepthPrepass(BloomRenderer::depthPrepassFromString(parser.value("depth-prepass")));
+    window.setDepthPrepassThreshold(parser.value("depth-prepass-threshold").toFloat());
+    window.setOverdrawCounter(parser.isSet("overdraw"));
+    window.setDeferredShading(parser.isSet("deferred"));
+    window.setSphereImpostors(parser.isSet("impostors"));
+    window.setPackedVertices(parser.isSet("packed-vertices"));
+    window.setOptimizeIndices(!parser.isSet("no-index-opt"));
+    window.setWeldTeapot(parser.isSet("weld"));
+    window.setTriangleStrips(parser.isSet("strips"));
+    window.setMeshCacheDir(meshCacheDir(parser));
+    window.setScene(scene);
+    window.show();
 
     return a.exec();
 }
@@ -0,0 +1,203 @@
+#include "meshcache.h"
+#include "vertexformat.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+
+#include <climits>
+#include <cstring>
+
+struct MeshFileHeader
+{
+    char    magic[4];
+    quint32 version;
+    quint64 paramsHash;
+    quint32 layout, nVerts, indexType, nIndices, mode;
+    float   center[3], radius;
+    float   boundsMin[3], boundsMax[3];
+    quint64 vertexOffset, vertexBytes;
+    quint64 indexOffset, indexBytes;
+};
+
+static const char   Magic[4]  = { 'B', 'M', 'S', 'H' };
+static const qint64 Alignment = 16;
+
+static qint64 alignUp(qint64 offset)
+{
+    return (offset + Alignment - 1) & ~(Alignment - 1);
+}
+
+// A block of bytes at offset lies inside a file of size bytes, written so
+// that nothing overflows
+static bool inFile(quint64 offset, quint64 bytes, quint64 size)
+{
+    return offset % Alignment == 0 && offset <= size && bytes <= size - offset;
+}
+
+// Everything a draw call or the CPU will trust: enums it understands and
+// blocks sized exactly for the counts, inside the file. The counts are
+// 32-bit, their products cannot overflow 64 bits.
+static bool validHeader(const MeshFileHeader *header, quint64 hash, qint64 size)
+{
+    if (std::memcmp(header->magic, Magic, sizeof(Magic)) != 0
+            || header->version != quint32(MeshCache::Version)
+            || header->paramsHash != hash)
+        return false;
+
+    quint64 stride;
+    if (header->layout == MeshPayload::Packed)
+        stride = sizeof(PackedVertex);
+    else if (header->layout == MeshPayload::SeparateFloats)
+        stride = 8 * sizeof(float);
+    else
+        return false;
+
+    quint64 indexSize;
+    if (header->indexType == GL_UNSIGNED_SHORT)
+        indexSize = sizeof(quint16);
+    else if (header->indexType == GL_UNSIGNED_INT)
+        indexSize = sizeof(quint32);
+    else
+        return false;
+
+    if (header->mode != GL_TRIANGLES && header->mode != GL_TRIANGLE_STRIP)
+        return false;
+
+    // Counts end up in ints
+    if (header->nVerts > quint32(INT_MAX) || header->nIndices > quint32(INT_MAX))
+        return false;
+
+    return quint64(header->nVerts) * stride == header->vertexBytes
+        && quint64(header->nIndices) * indexSize == header->indexBytes
+        && inFile(header->vertexOffset, header->vertexBytes, quint64(size))
+        && inFile(header->indexOffset, header->indexBytes, quint64(size));
+}
+
+MeshCache::MeshCache(const QString &dir)
+    : mDir(dir), mMap(0), mHits(0), mMisses(0)
+{
+}
+
+MeshCache::~MeshCache()
+{
+    release();
+}
+
+quint64 MeshCache::hash(const QByteArray &params)
+{
+    quint64 h = 14695981039346656037ULL;
+    for (int i = 0; i < params.size(); i++) {
+        h ^= quint8(params[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+QString MeshCache::path(quint64 hash) const
+{
+    return QDir(mDir).filePath(QString("%1.mesh").arg(hash, 16, 16, QChar('0')));
+}
+
+bool MeshCache::load(const QByteArray &params, MeshPayload &payload)
+{
+    release();
+    if (!enabled())
+        return false;
+
+    quint64 h = hash(params);
+    mFile.setFileName(path(h));
+    if (!mFile.open(QIODevice::ReadOnly)) {
+        mMisses++;
+        return false;
+    }
+
+    qint64 size = mFile.size();
+    if (size >= qint64(sizeof(MeshFileHeader)))
+        mMap = mFile.map(0, size);
+
+    const MeshFileHeader *header = reinterpret_cast<const MeshFileHeader *>(mMap);
+    if (header == 0 || !validHeader(header, h, size)) {
+        if (header != 0)
+            qWarning() << "Ignoring stale or damaged mesh cache file" << mFile.fileName();
+        release();
+        mMisses++;
+        return false;
+    }
+
+    payload.layout      = header->layout;
+    payload.nVerts      = int(header->nVerts);
+    payload.indexType   = header->indexType;
+    payload.nIndices    = int(header->nIndices);
+    payload.mode        = header->mode;
+    payload.vertexData  = mMap + header->vertexOffset;
+    payload.vertexBytes = qint64(header->vertexBytes);
+    payload.indexData   = mMap + header->indexOffset;
+    payload.indexBytes  = qint64(header->indexBytes);
+    payload.center      = QVector3D(header->center[0], header->center[1], header->center[2]);
+    payload.radius      = header->radius;
+    payload.boundsMin   = QVector3D(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]);
+    payload.boundsMax   = QVector3D(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]);
+
+    mHits++;
+    return true;
+}
+
+void MeshCache::release()
+{
+    if (mMap != 0)
+        mFile.unmap(mMap);
+    mMap = 0;
+    if (mFile.isOpen())
+        mFile.close();
+}
+
+bool MeshCache::save(const QByteArray &params, const MeshPayload &payload)
+{
+    if (!enabled())
+        return false;
+
+    if (!QDir().mkpath(mDir)) {
+        qWarning() << "Could not create mesh cache directory" << mDir;
+        return false;
+    }
+
+    MeshFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version      = Version;
+    header.paramsHash   = hash(params);
+    header.layout       = payload.layout;
+    header.nVerts       = quint32(payload.nVerts);
+    header.indexType    = payload.indexType;
+    header.nIndices     = quint32(payload.nIndices);
+    header.mode         = payload.mode;
+    header.center[0]    = payload.center.x();
+    header.center[1]    = payload.center.y();
+    header.center[2]    = payload.center.z();
+    header.radius       = payload.radius;
+    for (int c = 0; c < 3; c++) {
+        header.boundsMin[c] = payload.boundsMin[c];
+        header.boundsMax[c] = payload.boundsMax[c];
+    }
+    header.vertexOffset = alignUp(sizeof(header));
+    header.vertexBytes  = payload.vertexBytes;
+    header.indexOffset  = alignUp(header.vertexOffset + header.vertexBytes);
+    header.indexBytes   = payload.indexBytes;
+
+    // Written to a temporary and renamed, a crash never leaves half a file
+    QSaveFile file(path(header.paramsHash));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write mesh cache file" << file.fileName();
+        return false;
+    }
+
+    const QByteArray padding(Alignment, '\0');
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(padding.constData(), header.vertexOffset - sizeof(header));
+    file.write(static_cast<const char *>(payload.vertexData), payload.vertexBytes);
+    file.write(padding.constData(), header.indexOffset - header.vertexOffset - header.vertexBytes);
+    file.write(static_cast<const char *>(payload.indexData), payload.indexBytes);
+
+    return file.commit();
+}
@@ -0,0 +1,75 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <qopengl.h>
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector3D>
+
+// A mesh as glBufferData takes it: one vertex block in a given layout and
+// one index block. The pointers may point into a mapped cache file.
+struct MeshPayload
+{
+    // SeparateFloats: all positions, then all normals, then all tex coords.
+    // Packed: interleaved PackedVertex.
+    enum Layout { SeparateFloats = 0, Packed = 1 };
+
+    MeshPayload()
+        : layout(SeparateFloats), nVerts(0), indexType(GL_UNSIGNED_INT), nIndices(0),
+          mode(GL_TRIANGLES), vertexData(0), vertexBytes(0), indexData(0), indexBytes(0), radius(0.0f) {}
+
+    quint32     layout;
+    int         nVerts;
+    GLenum      indexType;
+    int         nIndices;
+    GLenum      mode;        // GL_TRIANGLES, or GL_TRIANGLE_STRIP with restart indices
+    const void *vertexData;
+    qint64      vertexBytes;
+    const void *indexData;
+    qint64      indexBytes;
+    QVector3D   center;      // bounding sphere, object space
+    float       radius;
+    QVector3D   boundsMin;   // bounding box, object space
+    QVector3D   boundsMax;
+};
+
+// Versioned binary mesh files, one per set of generator parameters, named
+// after the 64-bit FNV-1a hash of those parameters. A file is a fixed
+// header followed by the vertex and index payloads, 16-byte aligned, so a
+// hit maps the file and hands the mapping straight to glBufferData.
+class MeshCache
+{
+public:
+    enum { Version = 3 };
+
+    explicit MeshCache(const QString &dir = QString());
+    ~MeshCache();
+
+    // Empty disables the cache
+    void    setDirectory(const QString &dir) { mDir = dir; }
+    QString directory() const                { return mDir; }
+    bool    enabled() const                  { return !mDir.isEmpty(); }
+
+    static quint64 hash(const QByteArray &params);
+
+    // On success payload points into the mapped file until release()
+    bool load(const QByteArray &params, MeshPayload &payload);
+    void release();
+
+    bool save(const QByteArray &params, const MeshPayload &payload);
+
+    int hits() const   { return mHits; }
+    int misses() const { return mMisses; }
+
+private:
+    QString path(quint64 hash) const;
+
+    QString mDir;
+    QFile   mFile;
+    uchar  *mMap;
+    int     mHits, mMisses;
+};
+
+#endif // MESHCACHE_H
@@ -0,0 +1,97 @@
+#include "meshdata.h"
+
+#include <utility>
+
+static const qint64 Alignment = 16;
+
+static qint64 alignUp(qint64 offset)
+{
+    return (offset + Alignment - 1) & ~(Alignment - 1);
+}
+
+MeshData::MeshData()
+    : mArena(0), mBytes(0), mVerts(0), mCapacity(0), mIndices(0),
+      mNormalOffset(0), mTexCoordOffset(0), mIndexOffset(0), mStrips(false)
+{
+    for (int c = 0; c < 3; c++)
+        mBoundsMin[c] = mBoundsMax[c] = 0.0f;
+}
+
+MeshData::MeshData(int nVerts, int nIndices)
+    : mArena(0), mBytes(0), mVerts(nVerts), mCapacity(nVerts), mIndices(nIndices),
+      mStrips(false)
+{
+    mNormalOffset   = alignUp(3 * qint64(nVerts) * sizeof(float));
+    mTexCoordOffset = alignUp(mNormalOffset + 3 * qint64(nVerts) * sizeof(float));
+    mIndexOffset    = alignUp(mTexCoordOffset + 2 * qint64(nVerts) * sizeof(float));
+    mBytes          = alignUp(mIndexOffset + qint64(nIndices) * sizeof(unsigned int));
+
+    mArena = static_cast<char *>(qMallocAligned(size_t(mBytes), Alignment));
+    Q_CHECK_PTR(mArena);
+
+    for (int c = 0; c < 3; c++)
+        mBoundsMin[c] = mBoundsMax[c] = 0.0f;
+}
+
+MeshData::MeshData(MeshData &&other)
+    : MeshData()
+{
+    *this = std::move(other);
+}
+
+MeshData &MeshData::operator=(MeshData &&other)
+{
+    if (this != &other) {
+        release();
+        std::swap(mArena, other.mArena);
+        std::swap(mBytes, other.mBytes);
+        std::swap(mVerts, other.mVerts);
+        std::swap(mCapacity, other.mCapacity);
+        std::swap(mIndices, other.mIndices);
+        std::swap(mNormalOffset, other.mNormalOffset);
+        std::swap(mTexCoordOffset, other.mTexCoordOffset);
+        std::swap(mIndexOffset, other.mIndexOffset);
+        std::swap(mBoundsMin, other.mBoundsMin);
+        std::swap(mBoundsMax, other.mBoundsMax);
+        std::swap(mStrips, other.mStrips);
+    }
+    return *this;
+}
+
+MeshData::~MeshData()
+{
+    release();
+}
+
+void MeshData::setBounds(const float *min, const float *max)
+{
+    for (int c = 0; c < 3; c++) {
+        mBoundsMin[c] = min[c];
+        mBoundsMax[c] = max[c];
+    }
+}
+
+void MeshData::computeBounds()
+{
+    const float *p = positions();
+    for (int c = 0; c < 3; c++)
+        mBoundsMin[c] = mBoundsMax[c] = mVerts > 0 ? p[c] : 0.0f;
+
+    for (int i = 1; i < mVerts; i++)
+        for (int c = 0; c < 3; c++) {
+            mBoundsMin[c] = qMin(mBoundsMin[c], p[3*i + c]);
+            mBoundsMax[c] = qMax(mBoundsMax[c], p[3*i + c]);
+        }
+}
+
+void MeshData::release()
+{
+    if (mArena != 0)
+        qFreeAligned(mArena);
+
+    mArena = 0;
+    mBytes = 0;
+    mVerts = mCapacity = mIndices = 0;
+    mNormalOffset = mTexCoordOffset = mIndexOffset = 0;
+    mStrips = false;
+}
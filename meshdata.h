@@ -0,0 +1,69 @@
+#ifndef MESHDATA_H
+#define MESHDATA_H
+
+#include <QtGlobal>
+
+// CPU copy of a generated mesh in one aligned allocation: positions,
+// normals, tex coords and indices, each section 16-byte aligned. Move-only,
+// so a generator can hand its arrays to the uploader without a copy and
+// the uploader can drop them as soon as they are on the GPU.
+class MeshData
+{
+public:
+    // Ends a strip; GL_PRIMITIVE_RESTART_FIXED_INDEX of 32-bit indices, and
+    // narrowed to 16 bits it is the fixed index of those as well
+    static const unsigned int RestartIndex = 0xffffffffu;
+
+    MeshData();
+    MeshData(int nVerts, int nIndices);
+    MeshData(MeshData &&other);
+    MeshData &operator=(MeshData &&other);
+    ~MeshData();
+
+    bool isNull() const { return mArena == 0; }
+
+    float        *positions()       { return reinterpret_cast<float *>(mArena); }
+    const float  *positions() const { return reinterpret_cast<const float *>(mArena); }
+    float        *normals()         { return reinterpret_cast<float *>(mArena + mNormalOffset); }
+    const float  *normals() const   { return reinterpret_cast<const float *>(mArena + mNormalOffset); }
+    float        *texCoords()       { return reinterpret_cast<float *>(mArena + mTexCoordOffset); }
+    const float  *texCoords() const { return reinterpret_cast<const float *>(mArena + mTexCoordOffset); }
+    unsigned int       *indices()       { return reinterpret_cast<unsigned int *>(mArena + mIndexOffset); }
+    const unsigned int *indices() const { return reinterpret_cast<const unsigned int *>(mArena + mIndexOffset); }
+
+    int vertexCount() const { return mVerts; }
+    int indexCount() const  { return mIndices; }
+
+    // Indices are triangle strips separated by RestartIndex instead of a
+    // triangle list. Set by the generator.
+    bool strips() const         { return mStrips; }
+    void setStrips(bool strips) { mStrips = strips; }
+
+    // After welding fewer vertices are in use; the allocation stays
+    void setVertexCount(int nVerts) { mVerts = qMin(nVerts, mCapacity); }
+
+    // Size of the allocation
+    qint64 bytes() const { return mBytes; }
+
+    // Axis-aligned bounds of the positions in object space, set by the
+    // generator: analytically or with computeBounds() once the positions
+    // are final
+    const float *boundsMin() const { return mBoundsMin; }
+    const float *boundsMax() const { return mBoundsMax; }
+    void setBounds(const float *min, const float *max);
+    void computeBounds();
+
+    void release();
+
+private:
+    Q_DISABLE_COPY(MeshData)
+
+    char  *mArena;
+    qint64 mBytes;
+    int    mVerts, mCapacity, mIndices;
+    qint64 mNormalOffset, mTexCoordOffset, mIndexOffset;
+    float  mBoundsMin[3], mBoundsMax[3];
+    bool   mStrips;
+};
+
+#endif // MESHDATA_H
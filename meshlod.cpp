@@ -0,0 +1,80 @@
+#include "meshlod.h"
+
+#include <QtGlobal>
+
+#include <cmath>
+
+LodSelector::LodSelector(float hysteresis)
+    : mHysteresis(hysteresis), mLevel(-1)
+{
+}
+
+int LodSelector::select(const LodChain &chain, float diameterPx)
+{
+    int last = chain.levels.size() - 1;
+    if (last <= 0)
+        return mLevel = 0;
+
+    // Coarsest level that is still fine enough at this size
+    int target = 0;
+    while (target < last && diameterPx > chain.maxPixels[target])
+        target++;
+
+    if (mLevel < 0 || mLevel > last) {
+        mLevel = target;
+        return mLevel;
+    }
+
+    // Boundary between level l and l+1 is maxPixels[l]
+    while (mLevel < target && diameterPx > chain.maxPixels[mLevel] * (1.0f + mHysteresis))
+        mLevel++;
+    while (mLevel > target && diameterPx < chain.maxPixels[mLevel - 1] * (1.0f - mHysteresis))
+        mLevel--;
+
+    return mLevel;
+}
+
+float LodSelector::projectedDiameter(const QMatrix4x4 &modelView, const QMatrix4x4 &projection,
+                                     const QVector3D &center, float radius, int viewportHeight)
+{
+    // Radius in view space, assuming no more than uniform scale in modelView
+    float scale = modelView.mapVector(QVector3D(1.0f, 0.0f, 0.0f)).length();
+    return projectedDiameter(modelView.map(center), radius * scale, projection, viewportHeight);
+}
+
+float LodSelector::projectedDiameter(const QVector3D &viewCenter, float viewRadius,
+                                     const QMatrix4x4 &projection, int viewportHeight)
+{
+    float r = viewRadius;
+    float distance = viewCenter.length();
+    if (distance <= r)
+        return float(viewportHeight);
+
+    // projection(1,1) is cot(fovy/2): ndc height of a unit at unit distance
+    return r / distance * projection(1, 1) * float(viewportHeight);
+}
+
+void LodSelector::boundingSphere(const float *v, int nVerts, QVector3D &center, float &radius)
+{
+    if (nVerts <= 0) {
+        center = QVector3D();
+        radius = 0.0f;
+        return;
+    }
+
+    QVector3D lo(v[0], v[1], v[2]), hi = lo;
+    for (int i = 1; i < nVerts; i++) {
+        QVector3D p(v[3*i], v[3*i+1], v[3*i+2]);
+        lo = QVector3D(qMin(lo.x(), p.x()), qMin(lo.y(), p.y()), qMin(lo.z(), p.z()));
+        hi = QVector3D(qMax(hi.x(), p.x()), qMax(hi.y(), p.y()), qMax(hi.z(), p.z()));
+    }
+
+    center = (lo + hi) * 0.5f;
+
+    float r2 = 0.0f;
+    for (int i = 0; i < nVerts; i++) {
+        QVector3D d = QVector3D(v[3*i], v[3*i+1], v[3*i+2]) - center;
+        r2 = qMax(r2, d.lengthSquared());
+    }
+    radius = std::sqrt(r2);
+}
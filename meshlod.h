@@ -0,0 +1,72 @@
+#ifndef MESHLOD_H
+#define MESHLOD_H
+
+#include <qopengl.h>
+
+#include <QVector>
+#include <QVector3D>
+#include <QMatrix4x4>
+
+// GL objects of one uploaded mesh, everything its draw call needs
+struct MeshBuffers
+{
+    MeshBuffers() : vao(0), vbo(0), ibo(0), indexCount(0), indexType(GL_UNSIGNED_INT), mode(GL_TRIANGLES),
+                    triangleCount(0), vertexCount(0), layout(0), baseVertex(0), firstIndex(0), bytes(0), radius(0.0f) {}
+
+    GLuint    vao, vbo, ibo;
+    GLsizei   indexCount;
+    GLenum    indexType;
+    GLenum    mode;
+    GLsizei   triangleCount;   // strips count their degenerate triangles too
+    int       vertexCount;
+    quint32   layout;       // MeshPayload::Layout of the vertex data
+    GLint     baseVertex;   // where the mesh starts in shared buffers,
+    GLuint    firstIndex;   // 0 while it has its own
+    qint64    bytes;    // vertex and index data on the GPU
+    QVector3D center;   // bounding sphere, object space
+    float     radius;
+    QVector3D boundsMin, boundsMax;   // bounding box, object space
+};
+
+// The levels of one generated mesh, coarsest first, with the bounding
+// sphere of the finest level in object space
+struct LodChain
+{
+    LodChain() : radius(0.0f) {}
+
+    QVector<MeshBuffers> levels;
+    QVector<float>       maxPixels;  // largest on-screen diameter for each level
+    QVector3D            center;
+    float                radius;
+    QVector3D            boundsMin, boundsMax;   // all levels
+};
+
+// Picks the level of a LodChain for one drawn object from the projected
+// diameter of its bounding sphere. A level change only happens once the
+// diameter is past the threshold by the hysteresis fraction, so an object
+// sitting on a boundary does not pop between levels every frame.
+class LodSelector
+{
+public:
+    explicit LodSelector(float hysteresis = 0.1f);
+
+    int  select(const LodChain &chain, float diameterPx);
+    int  level() const { return mLevel; }
+    void reset()       { mLevel = -1; }
+
+    // On-screen diameter in pixels of a sphere given in object space
+    static float projectedDiameter(const QMatrix4x4 &modelView, const QMatrix4x4 &projection,
+                                   const QVector3D &center, float radius, int viewportHeight);
+    // The same for a sphere already in view space
+    static float projectedDiameter(const QVector3D &viewCenter, float viewRadius,
+                                   const QMatrix4x4 &projection, int viewportHeight);
+
+    // Centre of the bounding box and the farthest vertex from it
+    static void boundingSphere(const float *v, int nVerts, QVector3D &center, float &radius);
+
+private:
+    float mHysteresis;
+    int   mLevel;
+};
+
+#endif // MESHLOD_H
@@ -0,0 +1,397 @@
+#include "meshopt.h"
+#include "meshdata.h"
+
+#include <QHash>
+#include <QVector>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void CacheStats::add(const CacheStats &other)
+{
+    triangles += other.triangles;
+    vertices  += other.vertices;
+    misses    += other.misses;
+}
+
+// FIFO simulation of the vertex fetches, restart indices skipped
+static void simulateCache(CacheStats &stats, const unsigned int *indices, int nIndices,
+                          int nVerts, int cacheSize)
+{
+    // Timestamp of each vertex entering the FIFO, it is cached while
+    // fewer than cacheSize misses have happened since
+    QVector<qint64> entered(nVerts, -1);
+    QVector<bool>   used(nVerts, false);
+
+    for (int i = 0; i < nIndices; i++) {
+        unsigned int idx = indices[i];
+        if (idx == MeshData::RestartIndex)
+            continue;
+        if (!used[idx]) {
+            used[idx] = true;
+            stats.vertices++;
+        }
+        if (entered[idx] < 0 || stats.misses - entered[idx] >= cacheSize) {
+            entered[idx] = stats.misses;
+            stats.misses++;
+        }
+    }
+}
+
+CacheStats MeshOptimizer::analyzeCache(const unsigned int *indices, int nIndices, int nVerts, int cacheSize)
+{
+    CacheStats stats;
+    stats.triangles = nIndices / 3;
+    simulateCache(stats, indices, nIndices, nVerts, cacheSize);
+    return stats;
+}
+
+CacheStats MeshOptimizer::analyzeStripCache(const unsigned int *indices, int nIndices, int nVerts,
+                                            int cacheSize)
+{
+    CacheStats stats;
+    for (int i = 0; i + 2 < nIndices; i++) {
+        unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        if (a == MeshData::RestartIndex || b == MeshData::RestartIndex || c == MeshData::RestartIndex)
+            continue;
+        if (a != b && b != c && a != c)
+            stats.triangles++;
+    }
+    simulateCache(stats, indices, nIndices, nVerts, cacheSize);
+    return stats;
+}
+
+// Forsyth scoring: the three most recent vertices score a flat value so the
+// strip does not double back on itself, older ones decay with their cache
+// position, and vertices with few triangles left get a boost so islands
+// are finished instead of left behind
+static const int   MaxCacheSize     = 32;
+static const float CacheDecayPower  = 1.5f;
+static const float LastTriScore     = 0.75f;
+static const float ValenceBoostScale = 2.0f;
+static const float ValenceBoostPower = 0.5f;
+
+static float vertexScore(int cachePos, int remaining)
+{
+    if (remaining == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePos >= 0) {
+        if (cachePos < 3) {
+            score = LastTriScore;
+        } else {
+            float scaler = 1.0f / (MaxCacheSize - 3);
+            score = std::pow(1.0f - (cachePos - 3) * scaler, CacheDecayPower);
+        }
+    }
+
+    return score + ValenceBoostScale * std::pow(float(remaining), -ValenceBoostPower);
+}
+
+void MeshOptimizer::optimizeVertexCache(unsigned int *indices, int nIndices, int nVerts)
+{
+    int nTris = nIndices / 3;
+    if (nTris == 0)
+        return;
+
+    // Triangles of each vertex, as offsets into one adjacency array
+    QVector<int> remaining(nVerts, 0);
+    for (int i = 0; i < nTris * 3; i++)
+        remaining[indices[i]]++;
+
+    QVector<int> offset(nVerts + 1, 0);
+    for (int v = 0; v < nVerts; v++)
+        offset[v + 1] = offset[v] + remaining[v];
+
+    QVector<int> adjacency(nTris * 3);
+    QVector<int> fill = offset;
+    for (int t = 0; t < nTris; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[indices[3*t + k]]++] = t;
+
+    QVector<int>   cachePos(nVerts, -1);
+    QVector<float> vScore(nVerts);
+    for (int v = 0; v < nVerts; v++)
+        vScore[v] = vertexScore(-1, remaining[v]);
+
+    QVector<float> tScore(nTris);
+    QVector<bool>  emitted(nTris, false);
+    for (int t = 0; t < nTris; t++)
+        tScore[t] = vScore[indices[3*t]] + vScore[indices[3*t+1]] + vScore[indices[3*t+2]];
+
+    QVector<unsigned int> result(nTris * 3);
+    int cache[MaxCacheSize + 3];
+    int cacheCount = 0;
+
+    int best = 0;
+    for (int t = 1; t < nTris; t++)
+        if (tScore[t] > tScore[best])
+            best = t;
+
+    int scanFrom = 0;
+    for (int out = 0; out < nTris; out++) {
+        if (best < 0) {
+            // Nothing adjacent to the cache is left, take the next triangle in order
+            while (emitted[scanFrom])
+                scanFrom++;
+            best = scanFrom;
+        }
+
+        emitted[best] = true;
+        const unsigned int *tri = indices + 3 * best;
+        result[3*out]     = tri[0];
+        result[3*out + 1] = tri[1];
+        result[3*out + 2] = tri[2];
+
+        // Move the triangle's vertices to the front of the LRU cache
+        int newCache[MaxCacheSize + 3];
+        int newCount = 0;
+        for (int k = 0; k < 3; k++) {
+            int v = tri[k];
+            newCache[newCount++] = v;
+
+            // Take the triangle out of the vertex's live list
+            int *first = adjacency.data() + offset[v];
+            int *last  = first + remaining[v];
+            int *pos   = std::find(first, last, best);
+            *pos = *(last - 1);
+            remaining[v]--;
+        }
+        for (int c = 0; c < cacheCount; c++) {
+            int v = cache[c];
+            if (v != int(tri[0]) && v != int(tri[1]) && v != int(tri[2]))
+                newCache[newCount++] = v;
+        }
+
+        // Rescore everything that was or still is in the cache
+        for (int c = 0; c < newCount; c++) {
+            int v = newCache[c];
+            cachePos[v] = c < MaxCacheSize ? c : -1;
+            vScore[v] = vertexScore(cachePos[v], remaining[v]);
+        }
+
+        best = -1;
+        float bestScore = -1.0f;
+        for (int c = 0; c < newCount; c++) {
+            int v = newCache[c];
+            for (int a = offset[v]; a < offset[v] + remaining[v]; a++) {
+                int t = adjacency[a];
+                const unsigned int *nt = indices + 3 * t;
+                tScore[t] = vScore[nt[0]] + vScore[nt[1]] + vScore[nt[2]];
+                if (tScore[t] > bestScore) {
+                    bestScore = tScore[t];
+                    best = t;
+                }
+            }
+        }
+
+        cacheCount = qMin(newCount, MaxCacheSize);
+        std::memcpy(cache, newCache, cacheCount * sizeof(int));
+    }
+
+    std::memcpy(indices, result.constData(), nTris * 3 * sizeof(unsigned int));
+}
+
+void MeshOptimizer::optimizeOverdraw(unsigned int *indices, int nIndices, const float *v, int nVerts,
+                                     int cacheSize)
+{
+    int nTris = nIndices / 3;
+    if (nTris == 0)
+        return;
+
+    // Cluster starts: triangles whose three vertices all miss the cache
+    QVector<int>    clusters;
+    QVector<qint64> entered(nVerts, -1);
+    qint64 misses = 0;
+    for (int t = 0; t < nTris; t++) {
+        int triMisses = 0;
+        for (int k = 0; k < 3; k++) {
+            unsigned int idx = indices[3*t + k];
+            if (entered[idx] < 0 || misses - entered[idx] >= cacheSize) {
+                entered[idx] = misses++;
+                triMisses++;
+            }
+        }
+        if (t == 0 || triMisses == 3)
+            clusters << t;
+    }
+    clusters << nTris;
+
+    int nClusters = clusters.size() - 1;
+    if (nClusters < 2)
+        return;
+
+    // Area-weighted centroid and normal of each cluster, and of the mesh
+    QVector<float> centroid(nClusters * 3, 0.0f), normal(nClusters * 3, 0.0f), area(nClusters, 0.0f);
+    float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+    float meshArea = 0.0f;
+
+    for (int c = 0; c < nClusters; c++) {
+        for (int t = clusters[c]; t < clusters[c + 1]; t++) {
+            const float *p0 = v + 3 * indices[3*t];
+            const float *p1 = v + 3 * indices[3*t + 1];
+            const float *p2 = v + 3 * indices[3*t + 2];
+
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3]  = { e1[1]*e2[2] - e1[2]*e2[1], e1[2]*e2[0] - e1[0]*e2[2], e1[0]*e2[1] - e1[1]*e2[0] };
+            float a = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+
+            for (int k = 0; k < 3; k++) {
+                float mid = (p0[k] + p1[k] + p2[k]) / 3.0f;
+                centroid[3*c + k] += mid * a;
+                normal[3*c + k]   += n[k];
+                meshCentroid[k]   += mid * a;
+            }
+            area[c]  += a;
+            meshArea += a;
+        }
+    }
+
+    if (meshArea > 0.0f)
+        for (int k = 0; k < 3; k++)
+            meshCentroid[k] /= meshArea;
+
+    QVector<float> key(nClusters);
+    for (int c = 0; c < nClusters; c++) {
+        float len = std::sqrt(normal[3*c]*normal[3*c] + normal[3*c+1]*normal[3*c+1] + normal[3*c+2]*normal[3*c+2]);
+        float d = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            float cc = area[c] > 0.0f ? centroid[3*c + k] / area[c] : 0.0f;
+            d += (cc - meshCentroid[k]) * (len > 0.0f ? normal[3*c + k] / len : 0.0f);
+        }
+        key[c] = d;
+    }
+
+    // Most outward-facing first: those occlude the rest
+    QVector<int> order(nClusters);
+    for (int c = 0; c < nClusters; c++)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&key](int a, int b) { return key[a] > key[b]; });
+
+    QVector<unsigned int> result;
+    result.reserve(nTris * 3);
+    for (int i = 0; i < nClusters; i++) {
+        int c = order[i];
+        for (int t = clusters[c]; t < clusters[c + 1]; t++)
+            result << indices[3*t] << indices[3*t + 1] << indices[3*t + 2];
+    }
+
+    std::memcpy(indices, result.constData(), nTris * 3 * sizeof(unsigned int));
+}
+
+static quint32 cellHash(int x, int y, int z)
+{
+    return quint32(x) * 73856093u ^ quint32(y) * 19349663u ^ quint32(z) * 83492791u;
+}
+
+int MeshOptimizer::weldVertices(float *v, float *n, float *tc, int nVerts,
+                                unsigned int *indices, int nIndices,
+                                float posTolerance, float normalToleranceDeg, bool strips)
+{
+    float cell   = qMax(posTolerance, 1e-6f);
+    float tol2   = posTolerance * posTolerance;
+    float cosTol = std::cos(normalToleranceDeg * float(M_PI) / 180.0f);
+
+    // Group representatives chained per hash cell
+    QHash<quint32, int> cellHead;
+    QVector<int> nextInCell(nVerts, -1);
+    QVector<int> group(nVerts);
+    QVector<float> sum(nVerts * 3, 0.0f);
+
+    for (int i = 0; i < nVerts; i++) {
+        const float *p  = v + 3 * i;
+        const float *ni = n + 3 * i;
+        bool degenerate = ni[0] == 0.0f && ni[1] == 0.0f && ni[2] == 0.0f;
+
+        int cx = int(std::floor(p[0] / cell));
+        int cy = int(std::floor(p[1] / cell));
+        int cz = int(std::floor(p[2] / cell));
+
+        int match = -1;
+        for (int dx = -1; dx <= 1 && match < 0; dx++)
+            for (int dy = -1; dy <= 1 && match < 0; dy++)
+                for (int dz = -1; dz <= 1 && match < 0; dz++) {
+                    for (int r = cellHead.value(cellHash(cx + dx, cy + dy, cz + dz), -1); r >= 0; r = nextInCell[r]) {
+                        const float *q  = v + 3 * r;
+                        const float *nr = n + 3 * r;
+                        float d2 = (p[0]-q[0])*(p[0]-q[0]) + (p[1]-q[1])*(p[1]-q[1]) + (p[2]-q[2])*(p[2]-q[2]);
+                        if (d2 > tol2)
+                            continue;
+
+                        bool repDegenerate = nr[0] == 0.0f && nr[1] == 0.0f && nr[2] == 0.0f;
+                        if (degenerate || repDegenerate || ni[0]*nr[0] + ni[1]*nr[1] + ni[2]*nr[2] >= cosTol) {
+                            match = r;
+                            break;
+                        }
+                    }
+                }
+
+        if (match < 0) {
+            match = i;
+            quint32 key = cellHash(cx, cy, cz);
+            nextInCell[i] = cellHead.value(key, -1);
+            cellHead.insert(key, i);
+        }
+
+        group[i] = match;
+        for (int k = 0; k < 3; k++)
+            sum[3*match + k] += ni[k];
+    }
+
+    // Representatives keep their relative order, so the remap never moves
+    // a vertex forward and the arrays can be compacted in place
+    QVector<int> remap(nVerts, -1);
+    int count = 0;
+    for (int i = 0; i < nVerts; i++) {
+        if (group[i] != i)
+            continue;
+
+        float len = std::sqrt(sum[3*i]*sum[3*i] + sum[3*i+1]*sum[3*i+1] + sum[3*i+2]*sum[3*i+2]);
+        for (int k = 0; k < 3; k++) {
+            v[3*count + k] = v[3*i + k];
+            n[3*count + k] = len > 0.0f ? sum[3*i + k] / len : 0.0f;
+        }
+        tc[2*count]     = tc[2*i];
+        tc[2*count + 1] = tc[2*i + 1];
+        remap[i] = count++;
+    }
+
+    for (int i = 0; i < nIndices; i++)
+        if (indices[i] != MeshData::RestartIndex)
+            indices[i] = remap[group[indices[i]]];
+
+    // Groups made only of degenerate corners, like the poles of the lid
+    // and bottom, face the same way as the ring of vertices around them;
+    // of a strip every window of three indices is a triangle
+    QVector<float> ring(count * 3, 0.0f);
+    for (int t = 0; t + 2 < nIndices; t += strips ? 1 : 3) {
+        if (strips && (indices[t] == MeshData::RestartIndex ||
+                       indices[t + 1] == MeshData::RestartIndex ||
+                       indices[t + 2] == MeshData::RestartIndex))
+            continue;
+        for (int k = 0; k < 3; k++) {
+            unsigned int a = indices[t + k];
+            for (int o = 1; o < 3; o++) {
+                unsigned int b = indices[t + (k + o) % 3];
+                ring[3*a]     += n[3*b];
+                ring[3*a + 1] += n[3*b + 1];
+                ring[3*a + 2] += n[3*b + 2];
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        float *ni = n + 3 * i;
+        if (ni[0] != 0.0f || ni[1] != 0.0f || ni[2] != 0.0f)
+            continue;
+        float len = std::sqrt(ring[3*i]*ring[3*i] + ring[3*i+1]*ring[3*i+1] + ring[3*i+2]*ring[3*i+2]);
+        if (len > 0.0f)
+            for (int k = 0; k < 3; k++)
+                ni[k] = ring[3*i + k] / len;
+    }
+
+    return count;
+}
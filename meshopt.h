@@ -0,0 +1,56 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <QtGlobal>
+
+// Post-transform vertex cache behaviour of an index buffer, simulated
+// with a FIFO cache like the one in most GPUs
+struct CacheStats
+{
+    CacheStats() : triangles(0), vertices(0), misses(0) {}
+
+    void add(const CacheStats &other);
+
+    // Average cache miss ratio: shaded vertices per triangle, 0.5 at best
+    float acmr() const { return triangles ? float(misses) / triangles : 0.0f; }
+    // Average transformed to vertex ratio: shaded per referenced vertex, 1 at best
+    float atvr() const { return vertices ? float(misses) / vertices : 0.0f; }
+
+    qint64 triangles, vertices, misses;
+};
+
+// Reorders triangle lists in place. Neither pass touches the vertex
+// arrays, so the mesh renders exactly as before.
+class MeshOptimizer
+{
+public:
+    static CacheStats analyzeCache(const unsigned int *indices, int nIndices, int nVerts, int cacheSize = 16);
+    // The same for triangle strips ended by MeshData::RestartIndex; a
+    // restart fetches nothing, triangles repeating an index are not counted
+    static CacheStats analyzeStripCache(const unsigned int *indices, int nIndices, int nVerts,
+                                        int cacheSize = 16);
+
+    // Tom Forsyth's linear-speed greedy optimizer, with his scoring constants
+    static void optimizeVertexCache(unsigned int *indices, int nIndices, int nVerts);
+
+    // Splits the cache-ordered list where the cache goes cold and draws the
+    // outward-facing clusters first, which cuts overdraw from any viewpoint
+    // without giving back the cache order inside a cluster
+    static void optimizeOverdraw(unsigned int *indices, int nIndices, const float *v, int nVerts,
+                                 int cacheSize = 16);
+
+    // Merges vertices closer than posTolerance whose normals are within
+    // normalToleranceDeg, found through a spatial hash with cells of
+    // posTolerance. Compacts v, n and tc in place, remaps the indices and
+    // returns the new vertex count. Welded normals are averaged; a zero
+    // normal (a degenerate patch corner) welds with anything at its
+    // position and, if the whole group is degenerate, takes the average
+    // of its neighbours in the triangles around it. Tex coords of the
+    // first vertex of a group are kept. With strips the indices are
+    // triangle strips and restart indices are left alone.
+    static int weldVertices(float *v, float *n, float *tc, int nVerts,
+                            unsigned int *indices, int nIndices,
+                            float posTolerance, float normalToleranceDeg, bool strips = false);
+};
+
+#endif // MESHOPT_H
@@ -0,0 +1,291 @@
+#include "mywindow.h"
+#include "renderthread.h"
+#include "profiler.h"
+
+#include <QtGlobal>
+#include <QDebug>
+#include <QScreen>
+
+MyWindow::~MyWindow()
+{
+    if (mRenderThread != 0) {
+        // The thread destroys the renderer and context before it exits
+        delete mRenderThread;
+        return;
+    }
+
+    mContext->makeCurrent(this);
+    delete mRenderer;
+    mContext->doneCurrent();
+    delete mContext;
+}
+
+MyWindow::MyWindow(FrameScheduler::Mode pacing, bool useRenderThread)
+    : mContext(0), mRenderer(new BloomRenderer()), mRenderThread(0), mScheduler(pacing), mInitialized(false)
+{
+    setSurfaceType(QWindow::OpenGLSurface);
+    setFlags(Qt::Window | Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowMinMaxButtonsHint | Qt::WindowCloseButtonHint);
+
+    QSurfaceFormat format = BloomRenderer::surfaceFormat();
+    format.setSwapInterval(mScheduler.swapInterval());
+    setFormat(format);
+    create();
+
+    resize(800, 600);
+
+    // No parent: a threaded context has to be movable to the render thread
+    mContext = new QOpenGLContext();
+    mContext->setFormat(format);
+    mContext->create();
+
+    if (screen())
+        mScheduler.setRefreshRate(screen()->refreshRate());
+
+    if (useRenderThread && !QOpenGLContext::supportsThreadedOpenGL()) {
+        qWarning( "Threaded OpenGL is not supported here, rendering on the GUI thread" );
+        useRenderThread = false;
+    }
+
+    if (useRenderThread) {
+        mRenderThread = new RenderThread(this, mContext, mRenderer, &mScheduler, &mStateBuffer);
+        mRenderThread->start();
+    }
+
+    mState.setViewport(width(), height());
+    publishState();
+}
+
+void MyWindow::publishState()
+{
+    mStateBuffer.write(mState);
+}
+
+void MyWindow::setGpuStatsInterval(int intervalMs)
+{
+    mState.gpuStatsInterval = intervalMs;
+    publishState();
+}
+
+void MyWindow::setGpuTessellation(bool on)
+{
+    mState.gpuTessellation = on;
+    publishState();
+}
+
+void MyWindow::setLodEnabled(bool on)
+{
+    mState.lodEnabled = on;
+    publishState();
+}
+
+void MyWindow::setIndirectDraws(bool on)
+{
+    mState.indirectDraws = on;
+    publishState();
+}
+
+void MyWindow::setFrustumCulling(bool on)
+{
+    mState.frustumCulling = on;
+    publishState();
+}
+
+void MyWindow::setDepthPrepass(int mode)
+{
+    mState.depthPrepass = mode;
+    publishState();
+}
+
+void MyWindow::setDepthPrepassThreshold(float complexity)
+{
+    mState.depthPrepassThreshold = complexity;
+    publishState();
+}
+
+void MyWindow::setOverdrawCounter(bool on)
+{
+    mState.overdrawCounter = on;
+    publishState();
+}
+
+void MyWindow::setDeferredShading(bool on)
+{
+    mState.deferredShading = on;
+    publishState();
+}
+
+void MyWindow::setSphereImpostors(bool on)
+{
+    mState.sphereImpostors = on;
+    publishState();
+}
+
+void MyWindow::setPackedVertices(bool on)
+{
+    // The renderer reads it in initialize(), which waits for the first expose
+    mRenderer->setPackedVertices(on);
+}
+
+void MyWindow::setOptimizeIndices(bool on)
+{
+    mRenderer->setOptimizeIndices(on);
+}
+
+void MyWindow::setWeldTeapot(bool on)
+{
+    mRenderer->setWeldTeapot(on);
+}
+
+void MyWindow::setTriangleStrips(bool on)
+{
+    mRenderer->setTriangleStrips(on);
+}
+
+void MyWindow::setMeshCacheDir(const QString &dir)
+{
+    mRenderer->setMeshCacheDir(dir);
+}
+
+void MyWindow::setScene(const SceneStore &scene)
+{
+    // Like the options above, only safe before the first expose
+    mRenderer->setScene(scene);
+}
+
+bool MyWindow::event(QEvent *event)
+{
+    // Without a render thread, frames are driven by update requests, one per swap
+    if (event->type() == QEvent::UpdateRequest && mRenderThread == 0) {
+        render();
+        return true;
+    }
+
+    return QWindow::event(event);
+}
+
+void MyWindow::exposeEvent(QExposeEvent *)
+{
+    if (mRenderThread != 0)
+        mRenderThread->setExposed(isExposed());
+    else if (isExposed())
+        requestUpdate();
+}
+
+void MyWindow::resizeEvent(QResizeEvent *)
+{
+    // The renderer picks the new size up with the next snapshot
+    mState.setViewport(this->width(), this->height());
+    publishState();
+}
+
+void MyWindow::render()
+{
+    if(!isVisible() || !isExposed())
+        return;
+
+    if (!mContext->makeCurrent(this))
+        return;
+
+    if (!mInitialized) {
+        if (!mRenderer->initialize())
+            exit( 1 );
+        mInitialized = true;
+    }
+
+    SceneState state;
+    if (mStateBuffer.read(state))
+        mRenderer->setSceneState(state);
+
+    float timeS = (float)mScheduler.beginFrame();
+
+    mRenderer->setTargetFramebuffer(mContext->defaultFramebufferObject());
+    mRenderer->render(timeS);
+
+    // Blocks until the swap with a swap interval of 1, paces the next request
+    mContext->swapBuffers(this);
+    mScheduler.endFrame();
+
+    requestUpdate();
+}
+
+void MyWindow::keyPressEvent(QKeyEvent *keyEvent)
+{
+    switch(keyEvent->key())
+    {
+        case Qt::Key_P:
+            // Snapshot of the profiling zones recorded so far
+            if (Profiler::dump("bloom-trace.json"))
+                qDebug() << "wrote bloom-trace.json";
+            break;
+        case Qt::Key_O:
+            mState.displayMode = !mState.displayMode;
+            break;
+        case Qt::Key_Up:
+            break;
+        case Qt::Key_Down:
+            break;
+        case Qt::Key_Left:
+            mState.setCameraAngle(mState.angle - ToRadian(5.0f));
+            break;
+        case Qt::Key_Right:
+            mState.setCameraAngle(mState.angle + ToRadian(5.0f));
+            break;
+        case Qt::Key_Delete:
+            break;
+        case Qt::Key_PageDown:
+            break;
+        case Qt::Key_Home:
+            mState.setCameraAngle(0.0f);
+            break;
+        case Qt::Key_Z:
+            mState.depthPrepass = (mState.depthPrepass + 1) % (BloomRenderer::DepthPrepassAuto + 1);
+            qDebug() << "depth pre-pass" << BloomRenderer::depthPrepassName(mState.depthPrepass);
+            break;
+        case Qt::Key_Q:
+            break;
+        case Qt::Key_S:
+            mState.sphereImpostors = !mState.sphereImpostors;
+            qDebug() << "spheres as" << (mState.sphereImpostors ? "ray-cast impostors" : "meshes");
+            break;
+        case Qt::Key_D:
+            mState.deferredShading = !mState.deferredShading;
+            qDebug() << "pass1 shading" << (mState.deferredShading ? "deferred" : "forward");
+            break;
+        case Qt::Key_A:
+            break;
+        case Qt::Key_E:
+            break;
+        case Qt::Key_F:
+            if (mRenderThread != 0) {
+                mRenderThread->requestFrameStats();
+            } else {
+                qDebug() << qPrintable(mScheduler.summary());
+                mScheduler.resetStats();
+            }
+            break;
+        case Qt::Key_T:
+            mState.gpuTessellation = !mState.gpuTessellation;
+            qDebug() << "teapot tessellation on the" << (mState.gpuTessellation ? "GPU" : "CPU");
+            break;
+        case Qt::Key_L:
+            mState.lodEnabled = !mState.lodEnabled;
+            qDebug() << "mesh LOD" << (mState.lodEnabled ? "on" : "off");
+            break;
+        case Qt::Key_I:
+            mState.indirectDraws = !mState.indirectDraws;
+            qDebug() << "pass1 draws" << (mState.indirectDraws ? "multi-draw-indirect" : "direct");
+            break;
+        case Qt::Key_C:
+            mState.frustumCulling = !mState.frustumCulling;
+            qDebug() << "frustum culling" << (mState.frustumCulling ? "on" : "off");
+            break;
+        case Qt::Key_G:
+            // Toggle the periodic GPU pass report
+            mState.gpuStatsInterval = mState.gpuStatsInterval > 0 ? 0 : 2000;
+            break;
+        default:
+            break;
+    }
+
+    publishState();
+}
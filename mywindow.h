@@ -0,0 +1,62 @@
+#ifndef MYWINDOW_H
+#define MYWINDOW_H
+
+#include <QWindow>
+#include <QEvent>
+#include <QKeyEvent>
+
+#include <QOpenGLContext>
+
+#include "Bloom.h"
+#include "framescheduler.h"
+#include "scenestate.h"
+
+class RenderThread;
+
+class MyWindow : public QWindow
+{
+    Q_OBJECT
+
+public:
+    explicit MyWindow(FrameScheduler::Mode pacing = FrameScheduler::VsyncPaced, bool useRenderThread = true);
+    ~MyWindow();
+    virtual void keyPressEvent( QKeyEvent *keyEvent );
+
+    void setGpuStatsInterval(int intervalMs);
+    void setGpuTessellation(bool on);
+    void setLodEnabled(bool on);
+    void setIndirectDraws(bool on);
+    void setFrustumCulling(bool on);
+    void setDepthPrepass(int mode);
+    void setDepthPrepassThreshold(float complexity);   // before show()
+    void setOverdrawCounter(bool on);
+    void setDeferredShading(bool on);
+    void setSphereImpostors(bool on);
+    void setPackedVertices(bool on);   // before show(), the meshes are built once
+    void setOptimizeIndices(bool on);  // likewise
+    void setWeldTeapot(bool on);       // likewise
+    void setTriangleStrips(bool on);   // likewise
+    void setMeshCacheDir(const QString &dir);
+    void setScene(const SceneStore &scene);  // likewise
+
+private:
+    void render();
+    void publishState();
+
+protected:
+    bool event(QEvent *event);
+    void exposeEvent(QExposeEvent *);
+    void resizeEvent(QResizeEvent *);
+
+private:
+    QOpenGLContext *mContext;
+    BloomRenderer  *mRenderer;
+    RenderThread   *mRenderThread;   // null when rendering on the GUI thread
+
+    FrameScheduler   mScheduler;
+    SceneState       mState;         // GUI thread copy, published on change
+    SceneStateBuffer mStateBuffer;
+    bool             mInitialized;
+};
+
+#endif // MYWINDOW_H
@@ -0,0 +1,88 @@
+#include "offscreenrenderer.h"
+
+#include <QtGlobal>
+#include <QDebug>
+
+OffscreenRenderer::~OffscreenRenderer()
+{
+    if (mContext != 0 && mContext->makeCurrent(mSurface)) {
+        delete mRenderer;
+        delete mTarget;
+        mContext->doneCurrent();
+    } else {
+        // Never initialized, so it holds no GL objects
+        delete mRenderer;
+    }
+
+    delete mContext;
+    delete mSurface;
+}
+
+OffscreenRenderer::OffscreenRenderer()
+    : mSurface(0), mContext(0), mTarget(0), mRenderer(new BloomRenderer())
+{
+}
+
+bool OffscreenRenderer::create(const QSize &size)
+{
+    QSurfaceFormat format = BloomRenderer::surfaceFormat();
+    // The final image goes to a single-sampled FBO
+    format.setSamples(0);
+
+    mSurface = new QOffscreenSurface();
+    mSurface->setFormat(format);
+    mSurface->create();
+    if (!mSurface->isValid())
+    {
+        qWarning( "Could not create offscreen surface" );
+        return false;
+    }
+
+    mContext = new QOpenGLContext();
+    mContext->setFormat(format);
+    if (!mContext->create() || !mContext->makeCurrent(mSurface))
+    {
+        qWarning( "Could not create OpenGL context for offscreen rendering" );
+        return false;
+    }
+
+    qDebug() << "offscreen renderer: " << (const char *)mContext->functions()->glGetString(GL_RENDERER);
+
+    mRenderer->resize(size.width(), size.height());
+    if (!mRenderer->initialize())
+        return false;
+
+    resize(size);
+
+    return true;
+}
+
+void OffscreenRenderer::resize(const QSize &size)
+{
+    mContext->makeCurrent(mSurface);
+
+    if (mTarget != 0 && mTarget->size() == size)
+        return;
+
+    delete mTarget;
+    mTarget = new QOpenGLFramebufferObject(size, QOpenGLFramebufferObject::NoAttachment, GL_TEXTURE_2D, GL_RGBA8);
+
+    if (mRenderer->width() != size.width() || mRenderer->height() != size.height())
+        mRenderer->resize(size.width(), size.height());
+    mRenderer->setTargetFramebuffer(mTarget->handle());
+}
+
+void OffscreenRenderer::renderFrame(float timeS)
+{
+    mContext->makeCurrent(mSurface);
+
+    mRenderer->render(timeS);
+    mContext->functions()->glFlush();
+}
+
+QImage OffscreenRenderer::grabFrame()
+{
+    mContext->makeCurrent(mSurface);
+
+    return mTarget->toImage();
+}
@@ -0,0 +1,37 @@
+#ifndef OFFSCREENRENDERER_H
+#define OFFSCREENRENDERER_H
+
+#include <QSize>
+#include <QImage>
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+
+#include "Bloom.h"
+
+// Runs the bloom pipeline without a window: a QOffscreenSurface keeps the
+// context current and a framebuffer object replaces the default framebuffer
+// as the final target. Works with QT_QPA_PLATFORM=offscreen on Mesa llvmpipe.
+class OffscreenRenderer
+{
+public:
+    explicit OffscreenRenderer();
+    ~OffscreenRenderer();
+
+    bool create(const QSize &size);
+    void resize(const QSize &size);
+    void renderFrame(float timeS);
+    QImage grabFrame();
+
+    // Available before create() for the options initialize() reads
+    BloomRenderer *renderer() { return mRenderer; }
+
+private:
+    QOffscreenSurface        *mSurface;
+    QOpenGLContext           *mContext;
+    QOpenGLFramebufferObject *mTarget;
+    BloomRenderer            *mRenderer;
+};
+
+#endif // OFFSCREENRENDERER_H
@@ -0,0 +1,117 @@
+#include "overdrawcounter.h"
+
+OverdrawCounter::OverdrawCounter(int ringSize)
+    : mFuncs(0), mRingSize(ringSize), mFrame(0), mSlot(0), mPass(-1), mRecording(false)
+{
+    for (int p = 0; p < PassCount; p++)
+        mComplexity[p] = 0.0f;
+}
+
+void OverdrawCounter::initialize(QOpenGLFunctions_4_3_Core *funcs)
+{
+    mFuncs = funcs;
+
+    mQueries.resize(mRingSize * PassCount);
+    mFuncs->glGenQueries(mQueries.size(), mQueries.data());
+    mIssued.fill(false, mQueries.size());
+    mPending.fill(false, mRingSize);
+    mSlotOrder.fill(0, mRingSize);
+    mPixels.fill(0, mRingSize);
+}
+
+void OverdrawCounter::destroy()
+{
+    if (mFuncs != 0 && !mQueries.isEmpty())
+        mFuncs->glDeleteQueries(mQueries.size(), mQueries.data());
+    mQueries.clear();
+    mFuncs = 0;
+}
+
+void OverdrawCounter::beginFrame()
+{
+    if (mFuncs == 0)
+        return;
+
+    mSlot = mFrame % mRingSize;
+    mFrame++;
+
+    // Still waiting on this slot from mRingSize frames ago: skip counting
+    mRecording = !mPending[mSlot];
+    if (mRecording)
+        for (int p = 0; p < PassCount; p++)
+            mIssued[mSlot * PassCount + p] = false;
+}
+
+void OverdrawCounter::begin(int pass)
+{
+    if (!mRecording)
+        return;
+
+    mPass = pass;
+    mIssued[mSlot * PassCount + pass] = true;
+    mFuncs->glBeginQuery(GL_SAMPLES_PASSED, mQueries[mSlot * PassCount + pass]);
+}
+
+void OverdrawCounter::end()
+{
+    if (!mRecording || mPass < 0)
+        return;
+
+    mFuncs->glEndQuery(GL_SAMPLES_PASSED);
+    mPass = -1;
+}
+
+void OverdrawCounter::endFrame(qint64 pixels)
+{
+    if (!mRecording)
+        return;
+
+    mPending[mSlot]   = true;
+    mSlotOrder[mSlot] = mFrame;
+    mPixels[mSlot]    = pixels;
+    mRecording = false;
+}
+
+bool OverdrawCounter::collect()
+{
+    if (mFuncs == 0)
+        return false;
+
+    // Oldest frames first, the newest finished one is kept
+    bool updated = false;
+    for (int n = 0; n < mRingSize; n++)
+    {
+        int slot = -1;
+        for (int s = 0; s < mRingSize; s++)
+            if (mPending[s] && (slot < 0 || mSlotOrder[s] < mSlotOrder[slot]))
+                slot = s;
+        if (slot < 0)
+            break;
+
+        // Queries end in pass order, the last issued one finishes last
+        const GLuint *q = mQueries.constData() + slot * PassCount;
+        int last = -1;
+        for (int p = 0; p < PassCount; p++)
+            if (mIssued[slot * PassCount + p])
+                last = p;
+
+        if (last >= 0) {
+            GLint available = 0;
+            mFuncs->glGetQueryObjectiv(q[last], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+        }
+
+        for (int p = 0; p < PassCount; p++) {
+            GLuint64 samples = 0;
+            if (mIssued[slot * PassCount + p])
+                mFuncs->glGetQueryObjectui64v(q[p], GL_QUERY_RESULT, &samples);
+            mComplexity[p] = mPixels[slot] > 0 ? float(double(samples) / mPixels[slot]) : 0.0f;
+        }
+
+        mPending[slot] = false;
+        updated = true;
+    }
+
+    return updated;
+}
@@ -0,0 +1,50 @@
+#ifndef OVERDRAWCOUNTER_H
+#define OVERDRAWCOUNTER_H
+
+#include <QVector>
+#include <QOpenGLFunctions_4_3_Core>
+
+// Depth complexity of pass1 from GL_SAMPLES_PASSED queries: samples that
+// passed the depth test in the depth pre-pass and in the lighting pass,
+// per pixel of the viewport.
+//
+// Like GpuTimer, each frame takes one slot of a ring and results are read
+// only once available, a few frames later; a frame whose slot is still
+// pending is not counted.
+class OverdrawCounter
+{
+public:
+    enum Pass { DepthPass, ShadePass, PassCount };
+
+    explicit OverdrawCounter(int ringSize = 4);
+
+    void initialize(QOpenGLFunctions_4_3_Core *funcs);
+    void destroy();
+
+    void beginFrame();
+    void begin(int pass);
+    void end();
+    void endFrame(qint64 pixels);
+
+    // Reads every finished slot, true if there is a new result
+    bool collect();
+
+    // Samples per pixel of the last counted frame, 0 if the pass did not run
+    float complexity(int pass) const { return mComplexity[pass]; }
+
+private:
+    QOpenGLFunctions_4_3_Core *mFuncs;
+
+    int mRingSize, mFrame, mSlot, mPass;
+    bool mRecording;
+
+    QVector<GLuint> mQueries;   // mRingSize * PassCount
+    QVector<bool>   mIssued;    // per query
+    QVector<bool>   mPending;   // per slot
+    QVector<int>    mSlotOrder; // frame number recorded in each slot
+    QVector<qint64> mPixels;    // per slot
+
+    float mComplexity[PassCount];
+};
+
+#endif // OVERDRAWCOUNTER_H
@@ -0,0 +1,144 @@
+#include "profiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mutex                         ringsMutex;
+std::vector<Profiler::ThreadRing*> rings;   // never freed, threads may exit before the dump
+std::string                        exitPath;
+
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+void dumpAtExit()
+{
+    Profiler::dump(exitPath.c_str());
+}
+
+void writeEscaped(FILE *f, const char *s)
+{
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        fputc(*s, f);
+    }
+}
+
+}
+
+int64_t Profiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+Profiler::ThreadRing *Profiler::threadRing()
+{
+    static thread_local ThreadRing *ring = 0;
+
+    if (ring == 0) {
+        ring = new ThreadRing;
+        ring->head.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < RingSize; i++)
+            ring->slots[i].seq.store(0, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        ring->tid = (int)rings.size() + 1;
+        rings.push_back(ring);
+    }
+
+    return ring;
+}
+
+void Profiler::record(const char *name, int64_t startNs, int64_t endNs)
+{
+    ThreadRing *ring = threadRing();
+
+    // Single writer per ring, never blocked: the slot's sequence is odd
+    // while its fields change, which a concurrent dump checks for
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t seq  = 2 * (head / RingSize + 1);
+    Slot &s = ring->slots[head % RingSize];
+    s.seq.store(seq - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.name.store(name, std::memory_order_relaxed);
+    s.startNs.store(startNs, std::memory_order_relaxed);
+    s.endNs.store(endNs, std::memory_order_relaxed);
+    s.seq.store(seq, std::memory_order_release);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool Profiler::dump(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "{\"traceEvents\":[\n");
+
+    bool first = true;
+    std::vector<Event> events;
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    for (size_t r = 0; r < rings.size(); r++) {
+        ThreadRing *ring = rings[r];
+
+        // Its thread may still be recording. A slot whose sequence is not
+        // that of event i before and after the copy was being written or
+        // already holds a newer event, past the head read here: skip it.
+        events.clear();
+        uint32_t head  = ring->head.load(std::memory_order_acquire);
+        uint32_t count = head < (uint32_t)RingSize ? head : (uint32_t)RingSize;
+        for (uint32_t i = head - count; i != head; i++) {
+            const Slot &s = ring->slots[i % RingSize];
+            uint32_t seq = 2 * (i / RingSize + 1);
+            if (s.seq.load(std::memory_order_acquire) != seq)
+                continue;
+
+            Event e;
+            e.name    = s.name.load(std::memory_order_relaxed);
+            e.startNs = s.startNs.load(std::memory_order_relaxed);
+            e.endNs   = s.endNs.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) == seq)
+                events.push_back(e);
+        }
+
+        for (size_t i = 0; i < events.size(); i++) {
+            const Event &e = events[i];
+
+            fprintf(f, "%s{\"name\":\"", first ? "" : ",\n");
+            writeEscaped(f, e.name);
+            fprintf(f, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    ring->tid, e.startNs / 1000.0, (e.endNs - e.startNs) / 1000.0);
+            first = false;
+        }
+    }
+
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+
+    return true;
+}
+
+void Profiler::dumpOnExit(const char *path)
+{
+    bool registered = !exitPath.empty();
+    exitPath = path;
+
+    if (!registered)
+        atexit(dumpAtExit);
+}
+
+bool Profiler::enabled()
+{
+#ifdef BLOOM_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
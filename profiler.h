@@ -0,0 +1,81 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Scoped CPU profiling zones, exported as Chrome trace events
+// (chrome://tracing or ui.perfetto.dev).
+//
+// PROFILE_ZONE("name") records the enclosing scope. Each thread writes into
+// its own lock-free ring; the first zone of a thread registers its ring.
+// Every slot carries a sequence counter, odd while it is being written, so
+// a dump running alongside skips slots it could only read torn. Zone names
+// must be string literals.
+//
+// Zones are only compiled in with BLOOM_PROFILE defined (CONFIG+=bloom_profile),
+// otherwise the macro expands to nothing.
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b)  PROFILE_CONCAT_(a, b)
+
+#ifdef BLOOM_PROFILE
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#endif
+
+class Profiler
+{
+public:
+    static const int RingSize = 1 << 16;   // events kept per thread
+
+    struct Event
+    {
+        const char *name;
+        int64_t     startNs;
+        int64_t     endNs;
+    };
+
+    // Event number i of a ring sits in slot i % RingSize with sequence
+    // 2 * (i / RingSize + 1) once written, one less while being written
+    struct Slot
+    {
+        std::atomic<uint32_t>     seq;
+        std::atomic<const char *> name;
+        std::atomic<int64_t>      startNs;
+        std::atomic<int64_t>      endNs;
+    };
+
+    struct ThreadRing
+    {
+        std::atomic<uint32_t> head;
+        int                   tid;
+        Slot                  slots[RingSize];
+    };
+
+    static int64_t now();
+    static void    record(const char *name, int64_t startNs, int64_t endNs);
+
+    // Writes every recorded zone as trace-event JSON
+    static bool dump(const char *path);
+    static void dumpOnExit(const char *path);
+
+    static bool enabled();
+
+private:
+    static ThreadRing *threadRing();
+};
+
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char *name) : mName(name), mStart(Profiler::now()) {}
+    ~ProfileZone() { Profiler::record(mName, mStart, Profiler::now()); }
+
+private:
+    const char *mName;
+    int64_t     mStart;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,75 @@
+#include "renderqueue.h"
+
+#include <algorithm>
+#include <cstring>
+
+static inline quint64 field(quint32 value, int bits)
+{
+    return quint64(value) & ((quint64(1) << bits) - 1);
+}
+
+quint64 RenderQueue::makeKey(quint32 program, quint32 vao, quint32 material, quint32 depthBucket)
+{
+    return field(program, ProgramBits) << (VaoBits + MaterialBits + DepthBits)
+         | field(vao, VaoBits) << (MaterialBits + DepthBits)
+         | field(material, MaterialBits) << DepthBits
+         | field(depthBucket, DepthBits);
+}
+
+quint32 RenderQueue::depthBucket(float depth, float maxDepth)
+{
+    const quint32 last = (quint32(1) << DepthBits) - 1;
+    if (!(depth > 0.0f) || !(maxDepth > 0.0f))
+        return 0;
+    if (depth >= maxDepth)
+        return last;
+    return quint32(depth / maxDepth * last);
+}
+
+void RenderQueue::push(quint64 key, int item)
+{
+    Entry entry;
+    entry.key  = key;
+    entry.item = item;
+    mEntries << entry;
+}
+
+void RenderQueue::sort()
+{
+    mPasses = 0;
+    int n = mEntries.size();
+    if (n < 2)
+        return;
+
+    // All eight histograms in one read of the keys
+    int counts[8][256];
+    std::memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < n; i++) {
+        quint64 key = mEntries[i].key;
+        for (int b = 0; b < 8; b++)
+            counts[b][(key >> (8 * b)) & 0xff]++;
+    }
+
+    mScratch.resize(n);
+    Entry *src = mEntries.data(), *dst = mScratch.data();
+    for (int b = 0; b < 8; b++) {
+        int *count = counts[b];
+        if (count[(src[0].key >> (8 * b)) & 0xff] == n)
+            continue;
+
+        int offset = 0;
+        for (int v = 0; v < 256; v++) {
+            int c = count[v];
+            count[v] = offset;
+            offset += c;
+        }
+        for (int i = 0; i < n; i++)
+            dst[count[(src[i].key >> (8 * b)) & 0xff]++] = src[i];
+
+        std::swap(src, dst);
+        mPasses++;
+    }
+
+    if (src != mEntries.data())
+        mEntries.swap(mScratch);
+}
@@ -0,0 +1,44 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <QtGlobal>
+#include <QVector>
+
+// Opaque draws of one frame, each with a 64-bit sort key packing, from the
+// top, the program, the vertex array, the material and a depth bucket.
+// Sorted ascending, the draws change program, then vertex array, then
+// material as rarely as possible, and go front to back within one state.
+class RenderQueue
+{
+public:
+    enum { ProgramBits = 8, VaoBits = 16, MaterialBits = 20, DepthBits = 20 };
+
+    RenderQueue() : mPasses(0) {}
+
+    struct Entry
+    {
+        quint64 key;
+        int     item;   // caller's index
+    };
+
+    // Fields wider than their bits are truncated, which only costs order
+    static quint64 makeKey(quint32 program, quint32 vao, quint32 material, quint32 depthBucket);
+    // depth in [0, maxDepth], nearest first
+    static quint32 depthBucket(float depth, float maxDepth);
+
+    void clear()                          { mEntries.clear(); }
+    void push(quint64 key, int item);
+    // LSD radix sort, a byte per pass; passes where every key has the same
+    // byte are skipped, so a few programs and materials sort in few passes
+    void sort();
+
+    int size() const                      { return mEntries.size(); }
+    const Entry &at(int i) const          { return mEntries[i]; }
+    int passes() const                    { return mPasses; }   // last sort()
+
+private:
+    QVector<Entry> mEntries, mScratch;
+    int            mPasses;
+};
+
+#endif // RENDERQUEUE_H
@@ -0,0 +1,107 @@
+#include "renderthread.h"
+
+#include <QtGlobal>
+#include <QDebug>
+#include <QMutexLocker>
+
+static const unsigned long MakeCurrentRetryMs = 100;
+
+RenderThread::RenderThread(QWindow *window, QOpenGLContext *context, BloomRenderer *renderer,
+                           FrameScheduler *scheduler, SceneStateBuffer *state)
+    : mWindow(window), mContext(context), mRenderer(renderer), mScheduler(scheduler), mState(state),
+      mExposed(false), mStop(false)
+{
+    mContext->moveToThread(this);
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+    wait();
+
+    // Only left over if the thread never ran
+    delete mRenderer;
+    delete mContext;
+}
+
+void RenderThread::setExposed(bool exposed)
+{
+    QMutexLocker lock(&mMutex);
+    mExposed = exposed;
+    mCondition.wakeAll();
+}
+
+void RenderThread::stop()
+{
+    QMutexLocker lock(&mMutex);
+    mStop = true;
+    mCondition.wakeAll();
+}
+
+void RenderThread::run()
+{
+    SceneState state;
+    bool initialized = false;
+    bool makeCurrentFailed = false;
+
+    forever {
+        {
+            // Sleep while hidden instead of spinning on a dead surface
+            QMutexLocker lock(&mMutex);
+            while (!mExposed && !mStop)
+                mCondition.wait(&mMutex);
+            if (mStop)
+                break;
+        }
+
+        // Can fail for a moment while the surface is hidden or resized:
+        // skip the frame and try again on the next expose, or shortly
+        if (!mContext->makeCurrent(mWindow)) {
+            if (!makeCurrentFailed)
+                qWarning( "Render thread could not make the context current, skipping frames" );
+            makeCurrentFailed = true;
+
+            QMutexLocker lock(&mMutex);
+            if (!mStop)
+                mCondition.wait(&mMutex, MakeCurrentRetryMs);
+            continue;
+        }
+        makeCurrentFailed = false;
+
+        if (!initialized) {
+            if (!mRenderer->initialize()) {
+                qWarning( "Render thread could not initialize the renderer" );
+                break;
+            }
+            initialized = true;
+        }
+
+        mState->read(state);
+        mRenderer->setSceneState(state);
+
+        float timeS = (float)mScheduler->beginFrame();
+
+        mRenderer->setTargetFramebuffer(mContext->defaultFramebufferObject());
+        mRenderer->render(timeS);
+
+        mContext->swapBuffers(mWindow);
+        mScheduler->endFrame();
+
+        if (mFrameStatsRequested.testAndSetAcquire(1, 0)) {
+            qDebug() << qPrintable(mScheduler->summary());
+            mScheduler->resetStats();
+        }
+    }
+
+    // GL objects go away with the context that made them
+    if (mContext->makeCurrent(mWindow)) {
+        delete mRenderer;
+        mContext->doneCurrent();
+    } else {
+        delete mRenderer;
+    }
+    mRenderer = 0;
+
+    delete mContext;
+    mContext = 0;
+}
@@ -0,0 +1,48 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QWindow>
+#include <QOpenGLContext>
+
+#include "Bloom.h"
+#include "framescheduler.h"
+#include "scenestate.h"
+
+// Owns the GL context while it runs: initializes the renderer, consumes the
+// scene snapshots published by the GUI thread and swaps the window. Swaps
+// block here, never in the GUI event loop.
+class RenderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    // Takes ownership of context and renderer, both are destroyed on this thread
+    RenderThread(QWindow *window, QOpenGLContext *context, BloomRenderer *renderer,
+                 FrameScheduler *scheduler, SceneStateBuffer *state);
+    ~RenderThread();
+
+    void setExposed(bool exposed);
+    void stop();
+    void requestFrameStats() { mFrameStatsRequested.storeRelease(1); }
+
+protected:
+    void run();
+
+private:
+    QWindow          *mWindow;
+    QOpenGLContext   *mContext;
+    BloomRenderer    *mRenderer;
+    FrameScheduler   *mScheduler;
+    SceneStateBuffer *mState;
+
+    QMutex         mMutex;
+    QWaitCondition mCondition;
+    bool           mExposed, mStop;
+    QAtomicInt     mFrameStatsRequested;
+};
+
+#endif // RENDERTHREAD_H
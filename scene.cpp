@@ -0,0 +1,371 @@
+#include "scene.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include <cmath>
+
+static const char *meshNames[SceneStore::MeshCount] = { "teapot", "sphere", "plane" };
+static const float TwoPi = 6.28318530718f;
+
+// Small deterministic generator, so a stress scene is the same on every run
+static quint32 nextRandom(quint32 &state)
+{
+    state = state * 1664525u + 1013904223u;
+    return state;
+}
+
+static float randomFloat(quint32 &state, float lo, float hi)
+{
+    return lo + (hi - lo) * float(nextRandom(state) >> 8) / float(1 << 24);
+}
+
+static QVector3D toVector3D(const QJsonValue &value, const QVector3D &fallback)
+{
+    QJsonArray a = value.toArray();
+    if (a.size() != 3)
+        return fallback;
+    return QVector3D(a[0].toDouble(), a[1].toDouble(), a[2].toDouble());
+}
+
+static QJsonArray toJson(const QVector3D &v)
+{
+    return QJsonArray() << v.x() << v.y() << v.z();
+}
+
+void SceneStore::clear()
+{
+    mMeshes.clear();
+    mMaterials.clear();
+    for (int e = 0; e < ModelElements; e++)
+        mModel[e].clear();
+    for (int e = 0; e < NormalElements; e++)
+        mNormal[e].clear();
+    mScale.clear();
+    mMaterialNames.clear();
+    mKa.clear();
+    mKd.clear();
+    mKs.clear();
+    mShininess.clear();
+    mLightPositions.clear();
+    mLightIntensities.clear();
+    mLightRadii.clear();
+}
+
+int SceneStore::addMaterial(const QString &name, const QVector3D &ka, const QVector3D &kd,
+                            const QVector3D &ks, float shininess)
+{
+    mMaterialNames << name;
+    mKa << ka;
+    mKd << kd;
+    mKs << ks;
+    mShininess << shininess;
+    return mKd.size() - 1;
+}
+
+int SceneStore::addObject(Mesh mesh, const QMatrix4x4 &model, int material)
+{
+    mMeshes << quint8(mesh);
+    mMaterials << material;
+    for (int e = 0; e < ModelElements; e++)
+        mModel[e] << 0.0f;
+    for (int e = 0; e < NormalElements; e++)
+        mNormal[e] << 0.0f;
+    mScale << 0.0f;
+
+    int object = mMeshes.size() - 1;
+    setModel(object, model);
+    return object;
+}
+
+void SceneStore::setModel(int object, const QMatrix4x4 &model)
+{
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+            mModel[4*r + c][object] = model(r, c);
+
+    QVector3D x = model.column(0).toVector3D();
+    QVector3D y = model.column(1).toVector3D();
+    QVector3D z = model.column(2).toVector3D();
+    // The largest axis, so spheres scaled by it still hold a non-uniformly scaled mesh
+    mScale[object] = std::sqrt(qMax(x.lengthSquared(), qMax(y.lengthSquared(), z.lengthSquared())));
+
+    // Rotation and uniform scale: the upper 3x3 is its own inverse
+    // transpose up to scale, which the shaders normalise away
+    const float eps = 1.0e-4f;
+    float s2 = x.lengthSquared();
+    bool rigid = qAbs(y.lengthSquared() - s2) <= eps * s2 && qAbs(z.lengthSquared() - s2) <= eps * s2
+              && qAbs(QVector3D::dotProduct(x, y)) <= eps * s2
+              && qAbs(QVector3D::dotProduct(y, z)) <= eps * s2
+              && qAbs(QVector3D::dotProduct(z, x)) <= eps * s2;
+
+    QMatrix3x3 normal = rigid ? model.toGenericMatrix<3, 3>() : model.normalMatrix();
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            mNormal[3*r + c][object] = normal(r, c);
+}
+
+QMatrix4x4 SceneStore::model(int object) const
+{
+    QMatrix4x4 m;
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+            m(r, c) = mModel[4*r + c][object];
+    return m;
+}
+
+void SceneStore::addLight(const QVector3D &position, const QVector3D &intensity, float radius)
+{
+    mLightPositions << QVector4D(position, 1.0f);
+    mLightIntensities << intensity;
+    mLightRadii << qMax(0.0f, radius);
+}
+
+const char *SceneStore::meshName(int mesh)
+{
+    return (mesh >= 0 && mesh < MeshCount) ? meshNames[mesh] : "unknown";
+}
+
+int SceneStore::meshFromName(const QString &name)
+{
+    for (int i = 0; i < MeshCount; i++)
+        if (name == QLatin1String(meshNames[i]))
+            return i;
+    return -1;
+}
+
+bool SceneStore::load(const QString &fileName)
+{
+    clear();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open scene" << fileName;
+        return false;
+    }
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (doc.isNull()) {
+        qWarning() << "Could not parse scene" << fileName << ":" << error.errorString()
+                   << "at offset" << error.offset;
+        return false;
+    }
+    QJsonObject root = doc.object();
+
+    QHash<QString, int> materialIds;
+    foreach (const QJsonValue &value, root.value("materials").toArray()) {
+        QJsonObject m = value.toObject();
+        QString name = m.value("name").toString(QString("material%1").arg(materialCount()));
+        materialIds[name] = addMaterial(name,
+                                        toVector3D(m.value("ka"), QVector3D(0.2f, 0.2f, 0.2f)),
+                                        toVector3D(m.value("kd"), QVector3D(0.8f, 0.8f, 0.8f)),
+                                        toVector3D(m.value("ks"), QVector3D(1.0f, 1.0f, 1.0f)),
+                                        m.value("shininess").toDouble(100.0));
+    }
+    if (materialCount() == 0)
+        addMaterial("default", QVector3D(0.2f, 0.2f, 0.2f), QVector3D(0.8f, 0.8f, 0.8f),
+                    QVector3D(1.0f, 1.0f, 1.0f), 100.0f);
+
+    foreach (const QJsonValue &value, root.value("objects").toArray()) {
+        QJsonObject o = value.toObject();
+
+        int mesh = meshFromName(o.value("mesh").toString());
+        if (mesh < 0) {
+            qWarning() << "scene" << fileName << ": unknown mesh" << o.value("mesh").toString();
+            clear();
+            return false;
+        }
+
+        QString materialName = o.value("material").toString();
+        int material = materialIds.value(materialName, 0);
+        if (!materialName.isEmpty() && !materialIds.contains(materialName))
+            qWarning() << "scene" << fileName << ": unknown material" << materialName;
+
+        QMatrix4x4 model;
+        QJsonArray matrix = o.value("matrix").toArray();
+        if (matrix.size() == 16) {
+            float values[16];
+            for (int i = 0; i < 16; i++)
+                values[i] = matrix[i].toDouble();
+            model = QMatrix4x4(values);
+        } else {
+            model.translate(toVector3D(o.value("translate"), QVector3D()));
+            QJsonArray rotate = o.value("rotate").toArray();
+            if (rotate.size() == 4)
+                model.rotate(rotate[0].toDouble(), rotate[1].toDouble(), rotate[2].toDouble(), rotate[3].toDouble());
+            QJsonValue scale = o.value("scale");
+            if (scale.isDouble())
+                model.scale(scale.toDouble());
+            else
+                model.scale(toVector3D(scale, QVector3D(1.0f, 1.0f, 1.0f)));
+        }
+
+        addObject(Mesh(mesh), model, material);
+    }
+
+    foreach (const QJsonValue &value, root.value("lights").toArray()) {
+        QJsonObject l = value.toObject();
+        addLight(toVector3D(l.value("position"), QVector3D()),
+                 toVector3D(l.value("intensity"), QVector3D(1.0f, 1.0f, 1.0f)),
+                 float(l.value("radius").toDouble(0.0)));
+    }
+
+    qDebug() << "scene" << fileName << ":" << objectCount() << "objects," << materialCount()
+             << "materials," << lightCount() << "lights";
+    return true;
+}
+
+bool SceneStore::save(const QString &fileName) const
+{
+    QJsonArray materials;
+    for (int m = 0; m < materialCount(); m++) {
+        QJsonObject o;
+        o["name"]      = mMaterialNames[m];
+        o["ka"]        = toJson(mKa[m]);
+        o["kd"]        = toJson(mKd[m]);
+        o["ks"]        = toJson(mKs[m]);
+        o["shininess"] = mShininess[m];
+        materials << o;
+    }
+
+    // Matrices row by row, which keeps arbitrary transforms exact
+    QJsonArray objects;
+    for (int i = 0; i < objectCount(); i++) {
+        QJsonArray matrix;
+        for (int r = 0; r < 4; r++)
+            for (int c = 0; c < 4; c++)
+                matrix << model(i)(r, c);
+
+        QJsonObject o;
+        o["mesh"]     = QString(meshName(mMeshes[i]));
+        o["material"] = mMaterialNames[mMaterials[i]];
+        o["matrix"]   = matrix;
+        objects << o;
+    }
+
+    QJsonArray lights;
+    for (int l = 0; l < lightCount(); l++) {
+        QJsonObject o;
+        o["position"]  = toJson(mLightPositions[l].toVector3D());
+        o["intensity"] = toJson(mLightIntensities[l]);
+        if (mLightRadii[l] > 0.0f)
+            o["radius"] = mLightRadii[l];
+        lights << o;
+    }
+
+    QJsonObject root;
+    root["materials"] = materials;
+    root["objects"]   = objects;
+    root["lights"]    = lights;
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write scene" << fileName;
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    return file.commit();
+}
+
+SceneStore SceneStore::defaultScene()
+{
+    SceneStore scene;
+
+    QVector3D ka(0.2f, 0.2f, 0.2f), ks(1.0f, 1.0f, 1.0f);
+    int teapot = scene.addMaterial("teapot", ka, QVector3D(0.4f, 0.4f, 0.9f), ks, 100.0f);
+    int plane  = scene.addMaterial("plane",  ka, QVector3D(0.9f, 0.3f, 0.2f), ks, 100.0f);
+    int sphere = scene.addMaterial("sphere", ka, QVector3D(0.4f, 0.9f, 0.4f), ks, 100.0f);
+
+    QMatrix4x4 model;
+    model.translate( 3.0f, -5.0f, 1.5f);
+    model.rotate( -90.0f, QVector3D(1.0f, 0.0f, 0.0f));
+    scene.addObject(MeshTeapot, model, teapot);
+
+    // Back, top and bottom
+    model.setToIdentity();
+    model.rotate(90.0f, QVector3D(1.0f, 0.0f, 0.0f));
+    scene.addObject(MeshPlane, model, plane);
+    model.setToIdentity();
+    model.translate(0.0f,  5.0f, 0.0f);
+    model.rotate(180.0f, 1.0f, 0.0f, 0.0f);
+    scene.addObject(MeshPlane, model, plane);
+    model.setToIdentity();
+    model.translate(0.0f, -5.0f, 0.0f);
+    scene.addObject(MeshPlane, model, plane);
+
+    model.setToIdentity();
+    model.translate( -3.0f, -3.0f, 2.0f);
+    scene.addObject(MeshSphere, model, sphere);
+
+    QVector3D intense(1.0f, 1.0f, 1.0f);
+    scene.addLight(QVector3D(-7.0f, 4.0f, 2.5f), intense);
+    scene.addLight(QVector3D( 0.0f, 4.0f, 2.5f), intense);
+    scene.addLight(QVector3D( 7.0f, 4.0f, 2.5f), intense);
+
+    return scene;
+}
+
+SceneStore SceneStore::stress(int objects, int lights, quint32 seed)
+{
+    SceneStore scene;
+    quint32 state = seed;
+
+    // A handful of hues, shared so that objects batch by material
+    const int paletteSize = 8;
+    for (int m = 0; m < paletteSize; m++) {
+        float hue = float(m) / paletteSize * TwoPi;
+        QVector3D kd(0.5f + 0.4f * std::cos(hue),
+                     0.5f + 0.4f * std::cos(hue - TwoPi / 3.0f),
+                     0.5f + 0.4f * std::cos(hue + TwoPi / 3.0f));
+        scene.addMaterial(QString("stress%1").arg(m), QVector3D(0.1f, 0.1f, 0.1f), kd,
+                          QVector3D(0.8f, 0.8f, 0.8f), randomFloat(state, 20.0f, 120.0f));
+    }
+
+    // Cells of 6 units hold a teapot (about 6 wide) or a sphere (radius 2)
+    const float spacing = 6.0f;
+    int side = qMax(1, int(std::ceil(std::pow(double(objects), 1.0 / 3.0))));
+    float half = 0.5f * spacing * (side - 1);
+
+    for (int i = 0; i < objects; i++) {
+        int x = i % side, y = (i / side) % side, z = i / (side * side);
+
+        QMatrix4x4 model;
+        model.translate(x * spacing - half + randomFloat(state, -1.0f, 1.0f),
+                        y * spacing - half + randomFloat(state, -1.0f, 1.0f),
+                        z * spacing - half + randomFloat(state, -1.0f, 1.0f));
+        model.rotate(randomFloat(state, 0.0f, 360.0f), 0.0f, 1.0f, 0.0f);
+
+        int material = nextRandom(state) % paletteSize;
+        if (i % 2 == 0) {
+            model.rotate(-90.0f, 1.0f, 0.0f, 0.0f);
+            model.scale(0.5f);
+            scene.addObject(MeshTeapot, model, material);
+        } else {
+            scene.addObject(MeshSphere, model, material);
+        }
+    }
+
+    // Point lights reaching two cells. Keep the light reaching an average
+    // point roughly that of the three lights of the default room.
+    float extent = half + spacing;
+    float radius = 2.0f * spacing;
+    float overlap = lights * (2.0f / 3.0f * TwoPi * radius * radius * radius) / std::pow(2.0f * extent, 3.0f);
+    float scale = qMin(1.0f, 3.0f / qMax(1.0f, overlap));
+    for (int l = 0; l < lights; l++) {
+        float hue = randomFloat(state, 0.0f, TwoPi);
+        QVector3D intensity(0.6f + 0.4f * std::cos(hue),
+                            0.6f + 0.4f * std::cos(hue - TwoPi / 3.0f),
+                            0.6f + 0.4f * std::cos(hue + TwoPi / 3.0f));
+        scene.addLight(QVector3D(randomFloat(state, -extent, extent),
+                                 randomFloat(state, -extent, extent),
+                                 randomFloat(state, -extent, extent)), intensity * scale, radius);
+    }
+
+    return scene;
+}
@@ -0,0 +1,104 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <QString>
+#include <QVector>
+#include <QVector3D>
+#include <QVector4D>
+#include <QMatrix4x4>
+
+// Flat structure-of-arrays scene: object i is meshes()[i], model(i) and
+// materials()[i]; material m is ka()[m], kd()[m], ks()[m], shininess()[m];
+// light l is lightPositions()[l], lightIntensities()[l] and lightRadii()[l],
+// in world space.
+// Model matrices are affine and kept element-major, one array per element
+// of their top three rows, along with the normal matrix of each object, so
+// transforms of many objects can be computed a SIMD register at a time.
+//
+// Scene files are JSON:
+//   { "materials": [ { "name": "blue", "ka": [r,g,b], "kd": [r,g,b],
+//                      "ks": [r,g,b], "shininess": s } ],
+//     "objects":   [ { "mesh": "teapot", "material": "blue",
+//                      "translate": [x,y,z], "rotate": [deg,x,y,z],
+//                      "scale": s or [x,y,z] } ],
+//     "lights":    [ { "position": [x,y,z], "intensity": [r,g,b], "radius": r } ] }
+// An object takes "matrix", 16 floats row by row, instead of the
+// translate * rotate * scale fields. A light without "radius" reaches
+// everything and does not fall off, like the lights of the original demo.
+class SceneStore
+{
+public:
+    enum Mesh { MeshTeapot = 0, MeshSphere = 1, MeshPlane = 2, MeshCount };
+    enum { ModelElements = 12, NormalElements = 9 };
+
+    void clear();
+
+    int  addMaterial(const QString &name, const QVector3D &ka, const QVector3D &kd,
+                     const QVector3D &ks, float shininess);
+    int  addObject(Mesh mesh, const QMatrix4x4 &model, int material);
+    void setModel(int object, const QMatrix4x4 &model);
+    // radius is where the light has faded out, 0 for no falloff
+    void addLight(const QVector3D &position, const QVector3D &intensity, float radius = 0.0f);
+
+    int objectCount() const   { return mMeshes.size(); }
+    int materialCount() const { return mKd.size(); }
+    int lightCount() const    { return mLightPositions.size(); }
+
+    const QVector<quint8> &meshes() const    { return mMeshes; }
+    const QVector<int>    &materials() const { return mMaterials; }
+
+    QMatrix4x4 model(int object) const;
+
+    // Element 4 * row + column of every model matrix, row < 3
+    const float *modelElement(int element) const  { return mModel[element].constData(); }
+    // Element 3 * row + column of the inverse transpose of every upper 3x3,
+    // up to scale. Updated with the model; rigid transforms skip the inverse.
+    const float *normalElement(int element) const { return mNormal[element].constData(); }
+    // Longest model column, the scale of bounding spheres
+    float scale(int object) const { return mScale[object]; }
+
+    const QVector<QString>   &materialNames() const { return mMaterialNames; }
+    const QVector<QVector3D> &ka() const            { return mKa; }
+    const QVector<QVector3D> &kd() const            { return mKd; }
+    const QVector<QVector3D> &ks() const            { return mKs; }
+    const QVector<float>     &shininess() const     { return mShininess; }
+
+    const QVector<QVector4D> &lightPositions() const   { return mLightPositions; }
+    const QVector<QVector3D> &lightIntensities() const { return mLightIntensities; }
+    const QVector<float>     &lightRadii() const       { return mLightRadii; }
+
+    // False with a warning if the file cannot be read or parsed; the
+    // scene is left empty then
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+
+    // The room of the original demo: teapot, sphere, three planes and
+    // three lights
+    static SceneStore defaultScene();
+
+    // objects teapots and spheres, alternating, on a jittered grid around
+    // the origin with random orientations and materials, and coloured
+    // point lights of a few cells radius spread over the same volume. The
+    // same seed gives the same scene.
+    static SceneStore stress(int objects, int lights, quint32 seed = 1);
+
+    static const char *meshName(int mesh);
+    static int meshFromName(const QString &name);   // -1 if unknown
+
+private:
+    QVector<quint8> mMeshes;
+    QVector<int>    mMaterials;
+    QVector<float>  mModel[ModelElements];
+    QVector<float>  mNormal[NormalElements];
+    QVector<float>  mScale;
+
+    QVector<QString>   mMaterialNames;
+    QVector<QVector3D> mKa, mKd, mKs;
+    QVector<float>     mShininess;
+
+    QVector<QVector4D> mLightPositions;
+    QVector<QVector3D> mLightIntensities;
+    QVector<float>     mLightRadii;
+};
+
+#endif // SCENE_H
@@ -0,0 +1,65 @@
+#include "scenestate.h"
+
+#include <QMutexLocker>
+#include <QVector3D>
+
+#include <cmath>
+
+SceneState::SceneState()
+    : angle(0.0f), displayMode(true), gpuTessellation(false), lodEnabled(true), indirectDraws(false), frustumCulling(true), depthPrepass(0), depthPrepassThreshold(1.5f), overdrawCounter(false), deferredShading(false), sphereImpostors(false), width(800), height(600), gpuStatsInterval(0)
+{
+    setViewport(width, height);
+    setCameraAngle(angle);
+}
+
+void SceneState::setViewport(int w, int h)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    width  = w;
+    height = h;
+
+    projectionMatrix.setToIdentity();
+    projectionMatrix.perspective(60.0f, (float)width/(float)height, 0.3f, 100.0f);
+}
+
+void SceneState::setCameraAngle(float a)
+{
+    angle = a;
+
+    // Orbit the original eye point (2, 0, 14) around the y axis
+    float c = std::cos(angle), s = std::sin(angle);
+    QVector3D eye(2.0f * c + 14.0f * s, 0.0f, -2.0f * s + 14.0f * c);
+
+    viewMatrix.setToIdentity();
+    viewMatrix.lookAt(eye, QVector3D(0.0f,0.0f,0.0f), QVector3D(0.0f,1.0f,0.0f));
+}
+
+SceneStateBuffer::SceneStateBuffer()
+    : mFront(0), mVersion(0), mReadVersion(0)
+{
+}
+
+void SceneStateBuffer::write(const SceneState &state)
+{
+    // Only the writer changes mFront, so the back slot is ours to fill
+    int back = 1 - mFront;
+    mSlots[back] = state;
+
+    QMutexLocker lock(&mMutex);
+    mFront = back;
+    mVersion++;
+}
+
+bool SceneStateBuffer::read(SceneState &state)
+{
+    QMutexLocker lock(&mMutex);
+    if (mReadVersion == mVersion)
+        return false;
+
+    state = mSlots[mFront];
+    mReadVersion = mVersion;
+
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef SCENESTATE_H
+#define SCENESTATE_H
+
+#include <QMutex>
+#include <QMatrix4x4>
+
+// Everything the GUI thread decides about a frame. The renderer only ever
+// sees a copy, so input handling and rendering never share live data.
+struct SceneState
+{
+    SceneState();
+
+    void setViewport(int w, int h);
+    void setCameraAngle(float a);
+
+    QMatrix4x4 viewMatrix, projectionMatrix;
+    float      angle;            // camera orbit around the y axis, radians
+    bool       displayMode;      // with (true) or without effect (false)
+    bool       gpuTessellation;  // teapot from patches on the GPU
+    bool       lodEnabled;       // mesh levels from on-screen size
+    bool       indirectDraws;    // pass1 as one multi-draw-indirect
+    bool       frustumCulling;   // skip objects outside the view
+    int        depthPrepass;     // BloomRenderer::DepthPrepass
+    float      depthPrepassThreshold; // complexity above which auto turns it on
+    bool       overdrawCounter;  // occlusion queries on pass1
+    bool       deferredShading;  // pass1 through the G-buffer
+    bool       sphereImpostors;  // ray-cast quads instead of sphere meshes
+    int        width, height;
+    int        gpuStatsInterval; // ms between GPU pass reports, 0 = off
+};
+
+// Double-buffered snapshot: one writer (GUI thread) fills the back slot and
+// flips it to the front, one reader (render thread) copies the front slot.
+// The lock is only held to flip or copy, never while rendering.
+class SceneStateBuffer
+{
+public:
+    SceneStateBuffer();
+
+    void write(const SceneState &state);
+    bool read(SceneState &state);   // false if nothing new since the last read
+
+private:
+    QMutex     mMutex;
+    SceneState mSlots[2];
+    int        mFront;
+    quint64    mVersion, mReadVersion;
+};
+
+#endif // SCENESTATE_H
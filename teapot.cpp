@@ -1,59 +1,80 @@
 #include "teapot.h"
 #include "teapotdata.h"
+#include "bezier.h"
+#include "meshopt.h"
+#include "profiler.h"
 
 #include <cstdio>
+#include <algorithm>
+#include <utility>
 
 #include <QVector4D>
+#include <QtConcurrent>
 #include <qmath.h>
 
 Teapot::~Teapot()
 {
-    delete[] v;
-    delete[] n;
-    delete[] elems;
-    delete[] tc;
 }
 
-Teapot::Teapot(int grid, const QMatrix4x4 & lidTransform)
+Teapot::Teapot(int grid, const QMatrix4x4 & lidTransform, bool parallel, bool simd,
+               bool strips)
+    : mParallel(parallel), mSimd(simd), mStrips(strips)
 {
+    PROFILE_ZONE("Teapot");
+
     nVerts = 32 * (grid + 1) * (grid + 1);
     nFaces = grid * grid * 32;
-    v = new float[ nVerts * 3 ];
-    n = new float[ nVerts * 3 ];
-    tc = new float[ nVerts * 2 ];
-    elems = new unsigned int[nFaces * 6];
+    mData = MeshData(nVerts, 32 * patchIndices(grid, strips));
+    mData.setStrips(strips);
+    v = mData.positions();
+    n = mData.normals();
+    tc = mData.texCoords();
+    elems = mData.indices();
 
     generatePatches( v, n, tc, elems, grid );
     moveLid(grid, v, lidTransform);
+
+    // Welding merges positions but never moves them, the bounds hold
+    mData.computeBounds();
+}
+
+int Teapot::weld(float posTolerance, float normalToleranceDeg)
+{
+    PROFILE_ZONE("Teapot::weld");
+    int before = nVerts;
+    nVerts = MeshOptimizer::weldVertices(v, n, tc, nVerts, elems, mData.indexCount(),
+                                         posTolerance, normalToleranceDeg, mStrips);
+    mData.setVertexCount(nVerts);
+    return before - nVerts;
 }
 
 void Teapot::generatePatches(float * in_v, float * in_n, float * in_tc, unsigned int* in_el, int grid) {
     float * B = new float[4*(grid+1)];  // Pre-computed Bernstein basis functions
     float * dB = new float[4*(grid+1)]; // Pre-computed derivitives of basis functions
 
-    int idx = 0, elIndex = 0, tcIndex = 0;
-
     // Pre-compute the basis functions  (Bernstein polynomials)
     // and their derivatives
     computeBasisFunctions(B, dB, grid);
 
-    // Build each patch
-    // The rim
-    buildPatchReflect(0, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    // The body
-    buildPatchReflect(1, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    buildPatchReflect(2, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    // The lid
-    buildPatchReflect(3, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    buildPatchReflect(4, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    // The bottom
-    buildPatchReflect(5, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    // The handle
-    buildPatchReflect(6, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, false, true);
-    buildPatchReflect(7, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, false, true);
-    // The spout
-    buildPatchReflect(8, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, false, true);
-    buildPatchReflect(9, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, false, true);
+    // Lay out the 32 sub-patches first. Their output ranges only depend on
+    // their position in the list, so they can then be built in any order.
+    QVector<SubPatch> subPatches;
+    listSubPatches(subPatches, grid, mStrips);
+
+    // One set of row tables for every sub-patch; evaluation is const, so
+    // the parallel build shares it
+    const BezierRowEvaluator evaluator(B, dB, grid);
+
+    auto build = [&](SubPatch &sp) {
+        int index = sp.index, elIndex = sp.elIndex, tcIndex = sp.tcIndex;
+        buildPatch(sp.patch, B, dB, evaluator, in_v, in_n, in_tc, in_el,
+                   index, elIndex, tcIndex, grid, sp.reflect, sp.invertNormal);
+    };
+
+    if (mParallel)
+        QtConcurrent::blockingMap(subPatches, build);
+    else
+        std::for_each(subPatches.begin(), subPatches.end(), build);
 
     delete [] B;
     delete [] dB;
@@ -74,59 +95,109 @@ void Teapot::moveLid(int grid, float *in_v, const QMatrix4x4 & lidTransform) {
     }
 }
 
-void Teapot::buildPatchReflect(int patchNum,
-                                    float *B, float *dB,
-                                    float *in_v, float *in_n,
-                                    float *in_tc, unsigned int *in_el,
-                                    int &index, int &elIndex, int &tcIndex, int grid,
-                                    bool reflectX, bool reflectY)
+void Teapot::listSubPatches(QVector<SubPatch> &subPatches, int grid, bool strips)
 {
-    QVector3D patch[4][4];
-    QVector3D patchRevV[4][4];
-    getPatch(patchNum, patch, false);
-    getPatch(patchNum, patchRevV, true);
+    subPatches.reserve(32);
 
-    // Patch without modification
-    buildPatch(patch, B, dB, in_v, in_n, in_tc, in_el,
-               index, elIndex, tcIndex, grid, QMatrix3x3(), true);
+    // The rim
+    addPatchReflect(subPatches, 0, grid, strips, true, true);
+    // The body
+    addPatchReflect(subPatches, 1, grid, strips, true, true);
+    addPatchReflect(subPatches, 2, grid, strips, true, true);
+    // The lid
+    addPatchReflect(subPatches, 3, grid, strips, true, true);
+    addPatchReflect(subPatches, 4, grid, strips, true, true);
+    // The bottom
+    addPatchReflect(subPatches, 5, grid, strips, true, true);
+    // The handle
+    addPatchReflect(subPatches, 6, grid, strips, false, true);
+    addPatchReflect(subPatches, 7, grid, strips, false, true);
+    // The spout
+    addPatchReflect(subPatches, 8, grid, strips, false, true);
+    addPatchReflect(subPatches, 9, grid, strips, false, true);
+}
 
-    // Patch reflected in x
-    float matxdata[9] = {
+QVector<float> Teapot::patchControlPoints(const QMatrix4x4 &lidTransform)
+{
+    QVector<SubPatch> subPatches;
+    listSubPatches(subPatches, 1, false);
+
+    QVector<float> points;
+    points.reserve(subPatches.size() * 16 * 3);
+
+    for (int p = 0; p < subPatches.size(); p++) {
+        const SubPatch &sp = subPatches[p];
+        // Sub-patches 12 to 19 are the lid, as in moveLid()
+        bool lid = p >= 12 && p < 20;
+
+        for (int uc = 0; uc < 4; uc++) {
+            for (int vc = 0; vc < 4; vc++) {
+                QVector3D pt = mattimesvec(sp.reflect, sp.patch[uc][vc]);
+                if (lid)
+                    pt = lidTransform.map(pt);
+                points << pt.x() << pt.y() << pt.z();
+            }
+        }
+    }
+
+    return points;
+}
+
+void Teapot::addPatchReflect(QVector<SubPatch> &subPatches, int patchNum, int grid,
+                             bool strips, bool reflectX, bool reflectY)
+{
+    // Same order as the serial build: as is, x, y, then x and y
+    static const float matxdata[9] = {
         -1.0f, 0.0f, 0.0f,
          0.0f, 1.0f, 0.0f,
          0.0f, 0.0f, 1.0f};
-
-    if( reflectX ) {
-        buildPatch(patchRevV, B, dB, in_v, in_n, in_tc, in_el,
-                   index, elIndex, tcIndex, grid, QMatrix3x3(matxdata), false );
-    }
-
-    // Patch reflected in y
-    float matydata[9] = {
+    static const float matydata[9] = {
         1.0f,  0.0f, 0.0f,
         0.0f, -1.0f, 0.0f,
         0.0f,  0.0f, 1.0f
     };
-
-    if( reflectY ) {
-        buildPatch(patchRevV, B, dB, in_v, in_n, in_tc, in_el,
-                   index, elIndex, tcIndex, grid, QMatrix3x3(matydata), false );
-    }
-
-    // Patch reflected in x and y
-    float matxydata[9] = {
+    static const float matxydata[9] = {
        -1.0f,  0.0f, 0.0f,
         0.0f, -1.0f, 0.0f,
         0.0f,  0.0f, 1.0f
     };
-    if( reflectX && reflectY ) {
-        buildPatch(patch, B, dB, in_v, in_n, in_tc, in_el,
-                   index, elIndex, tcIndex, grid, QMatrix3x3(matxydata), true );
+
+    struct Variant { bool enabled; bool reverseV; const float *mat; bool invertNormal; };
+    Variant variants[4] = {
+        { true,                  false, 0,         true  },
+        { reflectX,              true,  matxdata,  false },
+        { reflectY,              true,  matydata,  false },
+        { reflectX && reflectY,  false, matxydata, true  }
+    };
+
+    int verts = (grid + 1) * (grid + 1);
+
+    for (int i = 0; i < 4; i++) {
+        if (!variants[i].enabled)
+            continue;
+
+        SubPatch sp;
+        int n = subPatches.size();
+        sp.index   = n * verts * 3;
+        sp.tcIndex = n * verts * 2;
+        sp.elIndex = n * patchIndices(grid, strips);
+        sp.reflect = variants[i].mat ? QMatrix3x3(variants[i].mat) : QMatrix3x3();
+        sp.invertNormal = variants[i].invertNormal;
+        getPatch(patchNum, sp.patch, variants[i].reverseV);
+
+        subPatches.append(sp);
     }
 }
 
+// Elements of one sub-patch: two triangles per quad, or a strip of both
+// vertex rows plus the restart per grid row
+int Teapot::patchIndices(int grid, bool strips)
+{
+    return strips ? grid * (2 * (grid + 1) + 1) : 6 * grid * grid;
+}
+
 void Teapot::buildPatch(QVector3D patch[][4],
-                           float *B, float *dB,
+                           float *B, float *dB, const BezierRowEvaluator &evaluator,
                            float *in_v, float *in_n, float *in_tc,
                            unsigned int *in_el,
                            int &index, int &elIndex, int &tcIndex, int grid, QMatrix3x3 reflect,
@@ -135,28 +206,56 @@ void Teapot::buildPatch(QVector3D patch[][4],
     int startIndex = index / 3;
     float tcFactor = 1.0f / grid;
 
-    for( int i = 0; i <= grid; i++ )
+    if (mSimd)
     {
-        for( int j = 0 ; j <= grid; j++)
-        {
-            QVector3D pt   = mattimesvec(reflect, evaluate(i,j,B,patch));
-            QVector3D norm = mattimesvec(reflect, evaluateNormal(i,j,B,dB,patch));
-            if( invertNormal )
-                norm = -norm;
-
-            in_v[index] = pt.x();
-            in_v[index+1] = pt.y();
-            in_v[index+2] = pt.z();
-
-            in_n[index] = norm.x();
-            in_n[index+1] = norm.y();
-            in_n[index+2] = norm.z();
-
-            in_tc[tcIndex] = i * tcFactor;
-            in_tc[tcIndex+1] = j * tcFactor;
+        // Whole rows at once; reflect is diagonal, so it is just sign flips
+        float cp[3][16];
+        for( int uc = 0; uc < 4; uc++ )
+            for( int vc = 0; vc < 4; vc++ ) {
+                cp[0][uc*4+vc] = patch[uc][vc].x();
+                cp[1][uc*4+vc] = patch[uc][vc].y();
+                cp[2][uc*4+vc] = patch[uc][vc].z();
+            }
 
-            index += 3;
-            tcIndex += 2;
+        for( int i = 0; i <= grid; i++ )
+        {
+            evaluator.evaluateRow(cp, i, reflect(0,0), reflect(1,1), invertNormal,
+                                  in_v + index, in_n + index);
+
+            for( int j = 0 ; j <= grid; j++)
+            {
+                in_tc[tcIndex] = i * tcFactor;
+                in_tc[tcIndex+1] = j * tcFactor;
+                tcIndex += 2;
+            }
+            index += 3 * (grid + 1);
+        }
+    }
+    else
+    {
+        for( int i = 0; i <= grid; i++ )
+        {
+            for( int j = 0 ; j <= grid; j++)
+            {
+                QVector3D pt   = mattimesvec(reflect, evaluate(i,j,B,patch));
+                QVector3D norm = mattimesvec(reflect, evaluateNormal(i,j,B,dB,patch));
+                if( invertNormal )
+                    norm = -norm;
+
+                in_v[index] = pt.x();
+                in_v[index+1] = pt.y();
+                in_v[index+2] = pt.z();
+
+                in_n[index] = norm.x();
+                in_n[index+1] = norm.y();
+                in_n[index+2] = norm.z();
+
+                in_tc[tcIndex] = i * tcFactor;
+                in_tc[tcIndex+1] = j * tcFactor;
+
+                index += 3;
+                tcIndex += 2;
+            }
         }
     }
 
@@ -164,6 +263,18 @@ void Teapot::buildPatch(QVector3D patch[][4],
     {
         int iStart = i * (grid+1) + startIndex;
         int nextiStart = (i+1) * (grid+1) + startIndex;
+        if( mStrips )
+        {
+            // Same winding as the list below
+            for( int j = 0; j <= grid; j++)
+            {
+                in_el[elIndex] = nextiStart + j;
+                in_el[elIndex+1] = iStart + j;
+                elIndex += 2;
+            }
+            in_el[elIndex++] = MeshData::RestartIndex;
+            continue;
+        }
         for( int j = 0; j < grid; j++)
         {
             in_el[elIndex] = iStart + j;
@@ -300,3 +411,17 @@ int Teapot::getnFaces()
     return nFaces;
 }
 
+int Teapot::getnElems()
+{
+    return mData.indexCount();
+}
+
+MeshData Teapot::takeData()
+{
+    v = n = tc = 0;
+    elems = 0;
+    nVerts = nFaces = 0;
+
+    return std::move(mData);
+}
+
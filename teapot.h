@@ -4,11 +4,34 @@
 #include <QMatrix4x4>
 #include <QMatrix3x3>
 #include <QVector3D>
+#include <QVector>
+
+#include "meshdata.h"
+
+class BezierRowEvaluator;
 
 class Teapot
 {
 private:
+    // One of the 32 reflected copies of the 10 base patches, with the
+    // offsets of its output ranges in the vertex, tex coord and element arrays
+    struct SubPatch
+    {
+        QVector3D  patch[4][4];
+        QMatrix3x3 reflect;
+        bool       invertNormal;
+        int        index, elIndex, tcIndex;
+    };
+
+    Q_DISABLE_COPY(Teapot)
+
     int nFaces;
+    bool mParallel;
+    bool mSimd;
+    bool mStrips;
+
+    // Storage of the arrays below
+    MeshData mData;
 
     // Vertices
     float *v;
@@ -26,26 +49,38 @@ private:
     void generateVerts(float * , float * ,float *, unsigned int *, float , float);
 
     void generatePatches(float * in_v, float * in_n, float *in_tc, unsigned int* in_el, int grid);
-    void buildPatchReflect(int patchNum,
-                           float *B, float *dB,
-                           float *v, float *n, float *, unsigned int *el,
-                           int &index, int &elIndex, int &, int grid,
-                           bool reflectX, bool reflectY);
+    static void listSubPatches(QVector<SubPatch> &subPatches, int grid, bool strips);
+    static void addPatchReflect(QVector<SubPatch> &subPatches, int patchNum, int grid,
+                                bool strips, bool reflectX, bool reflectY);
+    static int patchIndices(int grid, bool strips);
     void buildPatch(QVector3D patch[][4],
-                    float *B, float *dB,
+                    float *B, float *dB, const BezierRowEvaluator &evaluator,
                     float *in_v, float *in_n, float *in_tc, unsigned int *in_el,
                     int &index, int &elIndex, int &, int grid, QMatrix3x3 reflect, bool invertNormal);
-    void getPatch( int patchNum, QVector3D patch[][4], bool reverseV );
+    static void getPatch( int patchNum, QVector3D patch[][4], bool reverseV );
 
     void computeBasisFunctions( float * B, float * dB, int grid );
     QVector3D evaluate( int gridU, int gridV, float *B, QVector3D patch[][4] );
     QVector3D evaluateNormal( int gridU, int gridV, float *B, float *dB, QVector3D patch[][4] );
     void moveLid(int,float *,const QMatrix4x4 &);
-    QVector3D mattimesvec(QMatrix3x3, QVector3D);
+    static QVector3D mattimesvec(QMatrix3x3, QVector3D);
 
 public:
     ~Teapot();
-    Teapot(int grid, const QMatrix4x4& lidTransform);
+    // parallel tessellates the sub-patches on the global thread pool,
+    // the result is identical to the serial build. simd evaluates whole
+    // grid rows with BezierRowEvaluator instead of one QVector3D sum per
+    // point; results match the scalar path to float rounding. strips
+    // emits each patch as one triangle strip per grid row, ended by
+    // MeshData::RestartIndex, instead of two triangles per quad.
+    Teapot(int grid, const QMatrix4x4& lidTransform, bool parallel = true, bool simd = true,
+           bool strips = false);
+
+    // Merge the vertices duplicated along patch borders and at the poles,
+    // shrinking getnVerts() and remapping getelems(). Texture coordinates
+    // are per patch, so a welded seam keeps those of one side.
+    // Returns the number of vertices removed.
+    int weld(float posTolerance = 1e-4f, float normalToleranceDeg = 10.0f);
 
     float *getv();
     int    getnVerts();
@@ -54,6 +89,14 @@ public:
     unsigned int *getelems();
 
     int    getnFaces();
+    int    getnElems();    // 6 per face, or the strips with their restarts
+
+    // Hands the arrays over, leaving the teapot empty
+    MeshData takeData();
+
+    // Control points of the 32 sub-patches, 16 xyz points each with the
+    // reflections and lid transform applied, for GPU tessellation
+    static QVector<float> patchControlPoints(const QMatrix4x4& lidTransform);
 };
 
 #endif // VBOTEAPOT_H
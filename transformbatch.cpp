@@ -0,0 +1,157 @@
+#include "transformbatch.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TRANSFORM_SSE
+#endif
+
+TransformBatch::TransformBatch(const QMatrix4x4 &view, const QMatrix4x4 &projection)
+{
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++) {
+            mView[4*r + c]       = view(r, c);
+            mProjection[4*r + c] = projection(r, c);
+        }
+}
+
+static void writeMaterial(const SceneStore &scene, int object, ObjectGpu &out)
+{
+    int m = scene.materials()[object];
+    const QVector3D &ka = scene.ka()[m], &kd = scene.kd()[m], &ks = scene.ks()[m];
+
+    out.kd[0] = kd.x(); out.kd[1] = kd.y(); out.kd[2] = kd.z(); out.kd[3] = 0.0f;
+    out.ks[0] = ks.x(); out.ks[1] = ks.y(); out.ks[2] = ks.z(); out.ks[3] = 0.0f;
+    out.kaShininess[0] = ka.x(); out.kaShininess[1] = ka.y(); out.kaShininess[2] = ka.z();
+    out.kaShininess[3] = scene.shininess()[m];
+}
+
+void TransformBatch::computeOne(const SceneStore &scene, int object, ObjectGpu &out) const
+{
+    const float *V = mView, *P = mProjection;
+
+    float m[SceneStore::ModelElements], n[SceneStore::NormalElements];
+    for (int e = 0; e < SceneStore::ModelElements; e++)
+        m[e] = scene.modelElement(e)[object];
+    for (int e = 0; e < SceneStore::NormalElements; e++)
+        n[e] = scene.normalElement(e)[object];
+
+    // Both matrices are affine, the bottom row of the product is 0 0 0 1
+    float mv[16];
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+            mv[4*r + c] = V[4*r] * m[c] + V[4*r + 1] * m[4 + c] + V[4*r + 2] * m[8 + c]
+                        + (c == 3 ? V[4*r + 3] : 0.0f);
+    mv[12] = mv[13] = mv[14] = 0.0f;
+    mv[15] = 1.0f;
+
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++) {
+            out.modelView[4*c + r] = mv[4*r + c];
+            out.mvp[4*c + r] = P[4*r] * mv[c] + P[4*r + 1] * mv[4 + c] + P[4*r + 2] * mv[8 + c]
+                             + P[4*r + 3] * mv[12 + c];
+        }
+
+    // The view is rigid, so its upper 3x3 is its own inverse transpose
+    for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+            out.normalMatrix[4*c + r] = (r < 3 && c < 3)
+                ? V[4*r] * n[c] + V[4*r + 1] * n[3 + c] + V[4*r + 2] * n[6 + c] : 0.0f;
+
+    writeMaterial(scene, object, out);
+}
+
+#ifdef TRANSFORM_SSE
+// Four objects' values of one element; culled lists are sorted, so runs of
+// consecutive objects are common and take a single load
+static inline __m128 gather(const float *element, const int *o, bool contiguous)
+{
+    return contiguous ? _mm_loadu_ps(element + o[0])
+                      : _mm_setr_ps(element[o[0]], element[o[1]], element[o[2]], element[o[3]]);
+}
+
+static inline __m128 madd(__m128 a, __m128 b, __m128 c)
+{
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+#endif
+
+void TransformBatch::compute(const SceneStore &scene, const int *objects, int count, ObjectGpu *out) const
+{
+    int k = 0;
+
+#ifdef TRANSFORM_SSE
+    __m128 V[16], P[16];
+    for (int i = 0; i < 16; i++) {
+        V[i] = _mm_set1_ps(mView[i]);
+        P[i] = _mm_set1_ps(mProjection[i]);
+    }
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+    const float *modelElements[SceneStore::ModelElements], *normalElements[SceneStore::NormalElements];
+    for (int e = 0; e < SceneStore::ModelElements; e++)
+        modelElements[e] = scene.modelElement(e);
+    for (int e = 0; e < SceneStore::NormalElements; e++)
+        normalElements[e] = scene.normalElement(e);
+
+    for (; k + 4 <= count; k += 4) {
+        const int *o = objects + k;
+        bool contiguous = o[1] == o[0] + 1 && o[2] == o[0] + 2 && o[3] == o[0] + 3;
+
+        // One register per matrix element, one lane per object
+        __m128 m[SceneStore::ModelElements], n[SceneStore::NormalElements];
+        for (int e = 0; e < SceneStore::ModelElements; e++)
+            m[e] = gather(modelElements[e], o, contiguous);
+        for (int e = 0; e < SceneStore::NormalElements; e++)
+            n[e] = gather(normalElements[e], o, contiguous);
+
+        __m128 mv[16], mvp[16], nm[16];
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++) {
+                __m128 s = madd(V[4*r], m[c], madd(V[4*r + 1], m[4 + c], _mm_mul_ps(V[4*r + 2], m[8 + c])));
+                mv[4*r + c] = c == 3 ? _mm_add_ps(s, V[4*r + 3]) : s;
+            }
+        mv[12] = mv[13] = mv[14] = zero;
+        mv[15] = one;
+
+        for (int r = 0; r < 4; r++)
+            for (int c = 0; c < 4; c++) {
+                __m128 s = madd(P[4*r], mv[c], madd(P[4*r + 1], mv[4 + c], _mm_mul_ps(P[4*r + 2], mv[8 + c])));
+                mvp[4*r + c] = c == 3 ? _mm_add_ps(s, P[4*r + 3]) : s;
+            }
+
+        for (int i = 0; i < 16; i++)
+            nm[i] = zero;
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                nm[4*r + c] = madd(V[4*r], n[c], madd(V[4*r + 1], n[3 + c], _mm_mul_ps(V[4*r + 2], n[6 + c])));
+
+        // Transpose element-major lanes into per-object columns
+        __m128 columns[3][4][4];   // matrix, column, object
+        __m128 *sources[3] = { mv, mvp, nm };
+        for (int s = 0; s < 3; s++)
+            for (int c = 0; c < 4; c++) {
+                __m128 c0 = sources[s][c], c1 = sources[s][4 + c], c2 = sources[s][8 + c], c3 = sources[s][12 + c];
+                _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+                columns[s][c][0] = c0;
+                columns[s][c][1] = c1;
+                columns[s][c][2] = c2;
+                columns[s][c][3] = c3;
+            }
+
+        // Each object front to back
+        for (int j = 0; j < 4; j++) {
+            ObjectGpu &dst = out[k + j];
+            for (int c = 0; c < 4; c++)
+                _mm_storeu_ps(dst.modelView + 4*c, columns[0][c][j]);
+            for (int c = 0; c < 4; c++)
+                _mm_storeu_ps(dst.mvp + 4*c, columns[1][c][j]);
+            for (int c = 0; c < 4; c++)
+                _mm_storeu_ps(dst.normalMatrix + 4*c, columns[2][c][j]);
+            writeMaterial(scene, o[j], dst);
+        }
+    }
+#endif
+
+    for (; k < count; k++)
+        computeOne(scene, objects[k], out[k]);
+}
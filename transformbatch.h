@@ -0,0 +1,38 @@
+#ifndef TRANSFORMBATCH_H
+#define TRANSFORMBATCH_H
+
+#include <QMatrix4x4>
+
+#include "scene.h"
+
+// std430 entry of the Objects buffer of vshader.txt and fshader.txt
+struct ObjectGpu
+{
+    float modelView[16];
+    float mvp[16];
+    float normalMatrix[16];   // mat3 columns padded to vec4
+    float kd[4];
+    float ks[4];
+    float kaShininess[4];     // Ka, then the shininess in w
+};
+
+// Per-frame transform stage of pass1: modelview, MVP and normal matrix of
+// a list of scene objects, four objects per step with SSE over the
+// element-major model and normal matrices of SceneStore. The view and
+// projection elements are broadcast once per frame. Every ObjectGpu is
+// written front to back in one go, so the output can be a mapped buffer.
+class TransformBatch
+{
+public:
+    // view must be affine and rigid (a lookAt), projection can be anything
+    TransformBatch(const QMatrix4x4 &view, const QMatrix4x4 &projection);
+
+    void compute(const SceneStore &scene, const int *objects, int count, ObjectGpu *out) const;
+
+private:
+    void computeOne(const SceneStore &scene, int object, ObjectGpu &out) const;
+
+    float mView[16], mProjection[16];   // row-major
+};
+
+#endif // TRANSFORMBATCH_H
@@ -1,25 +1,30 @@
 #include "vboplane.h"
+#include "profiler.h"
 
 #include <cstdio>
 #include <cmath>
+#include <utility>
 
 VBOPlane::~VBOPlane()
 {
-    delete [] v;
-    delete [] n;
-    delete [] tex;
-    delete [] el;
 }
 
-VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, float tmax)
+VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, float tmax,
+                   bool strips)
 {
+    PROFILE_ZONE("VBOPlane");
+
     nFaces = xdivs * zdivs;
     nVerts = (xdivs+1) * (zdivs+1);
 
-    v = new float[3 * (xdivs + 1) * (zdivs + 1)];
-    n = new float[3 * (xdivs + 1) * (zdivs + 1)];
-    tex = new float[2 * (xdivs + 1) * (zdivs + 1)];
-    el = new unsigned int[6 * xdivs * zdivs];
+    // A strip row is both vertex rows plus the restart
+    int nIndices = strips ? zdivs * (2 * (xdivs+1) + 1) : 6 * nFaces;
+    mData = MeshData(nVerts, nIndices);
+    mData.setStrips(strips);
+    v = mData.positions();
+    n = mData.normals();
+    tex = mData.texCoords();
+    el = mData.indices();
 
     float x2 = xsize / 2.0f;
     float z2 = zsize / 2.0f;
@@ -51,6 +56,16 @@ VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, f
     for( int i = 0; i < zdivs; i++ ) {
         rowStart = i * (xdivs+1);
         nextRowStart = (i+1) * (xdivs+1);
+        if( strips ) {
+            // Same winding as the list below
+            for( int j = 0; j <= xdivs; j++ ) {
+                el[idx] = rowStart + j;
+                el[idx+1] = nextRowStart + j;
+                idx += 2;
+            }
+            el[idx++] = MeshData::RestartIndex;
+            continue;
+        }
         for( int j = 0; j < xdivs; j++ ) {
             el[idx] = rowStart + j;
             el[idx+1] = nextRowStart + j;
@@ -61,6 +76,10 @@ VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, f
             idx += 6;
         }
     }
+
+    const float bmin[3] = { -x2, 0.0f, -z2 };
+    const float bmax[3] = {  x2, 0.0f,  z2 };
+    mData.setBounds(bmin, bmax);
 /*
     unsigned int handle[4];
     glGenBuffers(4, handle);
@@ -119,3 +138,12 @@ unsigned int VBOPlane::getnFaces()
 {
     return nFaces;
 }
+
+MeshData VBOPlane::takeData()
+{
+    v = n = tex = 0;
+    el = 0;
+    nVerts = nFaces = 0;
+
+    return std::move(mData);
+}
@@ -1,11 +1,18 @@
 #ifndef VBOPLANE_H
 #define VBOPLANE_H
 
+#include "meshdata.h"
+
 class VBOPlane
 {
 private:
+    Q_DISABLE_COPY(VBOPlane)
+
     unsigned int nFaces;
 
+    // Storage of the arrays below
+    MeshData mData;
+
     // Vertices
     float *v;
     unsigned int nVerts;
@@ -22,7 +29,9 @@ private:
 
 public:
     ~VBOPlane();
-    VBOPlane(float, float, int, int, float smax = 1.0f, float tmax = 1.0f);
+    // strips emits one triangle strip per row, ended by
+    // MeshData::RestartIndex, instead of two triangles per quad
+    VBOPlane(float, float, int, int, float smax = 1.0f, float tmax = 1.0f, bool strips = false);
 
     float *getv();
     unsigned int getnVerts();
@@ -30,6 +39,9 @@ public:
     float *gettc();
     unsigned int *getelems();
     unsigned int  getnFaces();
+
+    // Hands the arrays over, leaving the plane empty
+    MeshData takeData();
 };
 
 #endif // VBOPLANE_H
@@ -1,35 +1,41 @@
 #include "vbosphere.h"
+#include "profiler.h"
 
 #include <cstdio>
 #include <cmath>
+#include <utility>
 
 VBOSphere::~VBOSphere()
 {
-    delete [] v;
-    delete [] n;
-    delete [] tex;
-    delete [] el;
 }
 
-VBOSphere::VBOSphere(float rad, int sl, int st) :
-       radius(rad), slices(sl), stacks(st) 
+VBOSphere::VBOSphere(float rad, int sl, int st, bool strip) :
+       radius(rad), slices(sl), stacks(st), strips(strip)
 {
-  
+    PROFILE_ZONE("VBOSphere");
+
     nVerts = (slices+1) * (stacks + 1);
     nFaces = (slices * 2 * (stacks-1) ) * 3;
 
+    // A slice strip is both vertex columns plus the restart
+    mData = MeshData(nVerts, strips ? slices * (2 * (stacks+1) + 1) : nFaces);
+    mData.setStrips(strips);
     // Verts
-    v = new float[3 * nVerts];
+    v = mData.positions();
     // Normals
-    n = new float[3 * nVerts];
+    n = mData.normals();
     // Tex coords
-    tex = new float[2 * nVerts];
+    tex = mData.texCoords();
     // Elements
-    el = new unsigned int[nFaces];
+    el = mData.indices();
 
     // Generate the vertex data
     generateVerts(v, n, tex, el);
 
+    const float bmin[3] = { -radius, -radius, -radius };
+    const float bmax[3] = {  radius,  radius,  radius };
+    mData.setBounds(bmin, bmax);
+
     /*
     // Create and populate the buffer objects
     unsigned int handle[4];
@@ -114,6 +120,16 @@ void VBOSphere::generateVerts(float * verts, float * norms, float * tex,
     for( int i = 0; i < slices; i++ ) {
         int stackStart = i * (stacks + 1);
         int nextStackStart = (i+1) * (stacks+1);
+        if( strips ) {
+            // Same winding as the list below
+            for( int j = 0; j <= stacks; j++ ) {
+                el[idx] = nextStackStart + j;
+                el[idx+1] = stackStart + j;
+                idx += 2;
+            }
+            el[idx++] = MeshData::RestartIndex;
+            continue;
+        }
         for( int j = 0; j < stacks; j++ ) {
 			if( j == 0 ) {
 				el[idx] = stackStart;
@@ -172,3 +188,12 @@ unsigned int VBOSphere::getnFaces()
     return nFaces;
 }
 
+MeshData VBOSphere::takeData()
+{
+    v = n = tex = 0;
+    el = 0;
+    nVerts = nFaces = 0;
+
+    return std::move(mData);
+}
+
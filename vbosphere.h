@@ -9,12 +9,18 @@
 #define ToDegree(x) ((x) * 180.0f / M_PI)
 #define TwoPI (float)(2 * M_PI)
 
+#include "meshdata.h"
+
 class VBOSphere
 {
 private:
+    Q_DISABLE_COPY(VBOSphere)
 
     unsigned int nFaces;
 
+    // Storage of the arrays below
+    MeshData mData;
+
     // Vertices
     float *v;
     unsigned int nVerts;
@@ -32,11 +38,14 @@ private:
     //GLuint nVerts, elements;
 	float radius;
     int slices, stacks;
+    bool strips;
 
     void generateVerts(float * , float * ,float *, unsigned int *);
 
 public:
-    VBOSphere(float, int, int);
+    // strips emits one triangle strip per slice, ended by
+    // MeshData::RestartIndex; its pole triangles are degenerate
+    VBOSphere(float, int, int, bool strips = false);
     ~VBOSphere();
 
     //void render() const;
@@ -49,6 +58,9 @@ public:
     float *gettc();
     unsigned int *getelems();
     unsigned int  getnFaces();
+
+    // Hands the arrays over, leaving the sphere empty
+    MeshData takeData();
 };
 
 #endif // VBOSPHERE_H
@@ -0,0 +1,175 @@
+#include "vertexformat.h"
+
+#include <cmath>
+#include <cstring>
+
+void PackStats::add(const PackStats &other)
+{
+    floatBytes       += other.floatBytes;
+    packedBytes      += other.packedBytes;
+    maxNormalError   = qMax(maxNormalError, other.maxNormalError);
+    maxTexCoordError = qMax(maxTexCoordError, other.maxTexCoordError);
+}
+
+const void *PackedMesh::indexData() const
+{
+    if (indexType == GL_UNSIGNED_SHORT)
+        return indices16.constData();
+    return indices32.constData();
+}
+
+int PackedMesh::indexBytes() const
+{
+    if (indexType == GL_UNSIGNED_SHORT)
+        return indices16.size() * sizeof(quint16);
+    return indices32.size() * sizeof(unsigned int);
+}
+
+PackedMesh VertexFormat::pack(const float *v, const float *n, const float *tc, int nVerts,
+                              const unsigned int *elems, int nIndices)
+{
+    PackedMesh mesh;
+    mesh.vertices.resize(nVerts);
+
+    for (int i = 0; i < nVerts; i++) {
+        PackedVertex &pv = mesh.vertices[i];
+        pv.position[0] = v[3*i];
+        pv.position[1] = v[3*i+1];
+        pv.position[2] = v[3*i+2];
+
+        // Generators hand out unit normals, but don't rely on it for the error
+        float len = std::sqrt(n[3*i]*n[3*i] + n[3*i+1]*n[3*i+1] + n[3*i+2]*n[3*i+2]);
+        float unit[3] = { 0.0f, 0.0f, 1.0f };
+        if (len > 0.0f) {
+            unit[0] = n[3*i] / len;
+            unit[1] = n[3*i+1] / len;
+            unit[2] = n[3*i+2] / len;
+        }
+        octEncode(unit, pv.normal);
+
+        float decoded[3];
+        octDecode(pv.normal, decoded);
+        float d = qBound(-1.0f, unit[0]*decoded[0] + unit[1]*decoded[1] + unit[2]*decoded[2], 1.0f);
+        mesh.stats.maxNormalError = qMax(mesh.stats.maxNormalError, float(std::acos(d) * 180.0 / M_PI));
+
+        for (int c = 0; c < 2; c++) {
+            pv.texCoord[c] = toHalf(tc[2*i+c]);
+            mesh.stats.maxTexCoordError = qMax(mesh.stats.maxTexCoordError,
+                                               std::fabs(fromHalf(pv.texCoord[c]) - tc[2*i+c]));
+        }
+    }
+
+    // 0xffff is left free: with primitive restart enabled it ends a strip,
+    // and MeshData::RestartIndex narrows to it
+    if (nVerts < 65536) {
+        mesh.indexType = GL_UNSIGNED_SHORT;
+        mesh.indices16.resize(nIndices);
+        for (int i = 0; i < nIndices; i++)
+            mesh.indices16[i] = quint16(elems[i]);
+    } else {
+        mesh.indexType = GL_UNSIGNED_INT;
+        mesh.indices32.resize(nIndices);
+        std::memcpy(mesh.indices32.data(), elems, nIndices * sizeof(unsigned int));
+    }
+
+    mesh.stats.floatBytes  = qint64(nVerts) * 8 * sizeof(float) + qint64(nIndices) * sizeof(unsigned int);
+    mesh.stats.packedBytes = qint64(nVerts) * sizeof(PackedVertex) + mesh.indexBytes();
+
+    return mesh;
+}
+
+static float signNotZero(float x)
+{
+    return x >= 0.0f ? 1.0f : -1.0f;
+}
+
+void VertexFormat::octEncode(const float n[3], qint16 out[2])
+{
+    float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+    float x = n[0] / l1, y = n[1] / l1;
+
+    // Fold the lower hemisphere over the diagonals
+    if (n[2] < 0.0f) {
+        float fx = (1.0f - std::fabs(y)) * signNotZero(x);
+        float fy = (1.0f - std::fabs(x)) * signNotZero(y);
+        x = fx;
+        y = fy;
+    }
+
+    out[0] = qint16(qRound(qBound(-1.0f, x, 1.0f) * 32767.0f));
+    out[1] = qint16(qRound(qBound(-1.0f, y, 1.0f) * 32767.0f));
+}
+
+void VertexFormat::octDecode(const qint16 in[2], float n[3])
+{
+    // snorm16 as the GL unpacks it
+    float x = qMax(in[0] / 32767.0f, -1.0f);
+    float y = qMax(in[1] / 32767.0f, -1.0f);
+    float z = 1.0f - std::fabs(x) - std::fabs(y);
+
+    if (z < 0.0f) {
+        float ux = (1.0f - std::fabs(y)) * signNotZero(x);
+        float uy = (1.0f - std::fabs(x)) * signNotZero(y);
+        x = ux;
+        y = uy;
+    }
+
+    float len = std::sqrt(x*x + y*y + z*z);
+    n[0] = x / len;
+    n[1] = y / len;
+    n[2] = z / len;
+}
+
+quint16 VertexFormat::toHalf(float f)
+{
+    quint32 x;
+    std::memcpy(&x, &f, sizeof(x));
+
+    quint32 sign = (x >> 16) & 0x8000;
+    int     e    = (x >> 23) & 0xff;
+    quint32 mant = x & 0x7fffff;
+
+    if (e == 0xff)
+        return quint16(sign | 0x7c00 | (mant ? 0x200 : 0));   // inf, nan
+
+    int exp = e - 127 + 15;
+    if (exp >= 31)
+        return quint16(sign | 0x7c00);                         // overflow to inf
+
+    if (exp <= 0) {
+        // Subnormal half, or zero
+        if (exp < -10)
+            return quint16(sign);
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        quint32 half = mant >> shift;
+        quint32 rem  = mant & ((1u << shift) - 1);
+        quint32 mid  = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1)))
+            half++;
+        return quint16(sign | half);
+    }
+
+    // A carry out of the mantissa correctly bumps the exponent
+    quint32 half = (quint32(exp) << 10) | (mant >> 13);
+    quint32 rem  = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+        half++;
+    return quint16(sign | half);
+}
+
+float VertexFormat::fromHalf(quint16 h)
+{
+    int     exp  = (h >> 10) & 0x1f;
+    quint32 mant = h & 0x3ff;
+
+    float f;
+    if (exp == 0)
+        f = std::ldexp(float(mant), -24);
+    else if (exp == 31)
+        f = mant ? NAN : INFINITY;
+    else
+        f = std::ldexp(float(mant | 0x400), exp - 25);
+
+    return (h & 0x8000) ? -f : f;
+}
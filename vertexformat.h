@@ -0,0 +1,57 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <qopengl.h>
+
+#include <QtGlobal>
+#include <QVector>
+
+// Interleaved 20-byte vertex, against 32 bytes for the three float arrays:
+// float position, octahedral normal in two snorm16, half-float tex coords
+struct PackedVertex
+{
+    float   position[3];
+    qint16  normal[2];
+    quint16 texCoord[2];
+};
+
+// Size of a mesh in both layouts and the worst error packing introduced
+struct PackStats
+{
+    PackStats() : floatBytes(0), packedBytes(0), maxNormalError(0.0f), maxTexCoordError(0.0f) {}
+
+    void add(const PackStats &other);
+
+    qint64 floatBytes, packedBytes;  // vertices + indices
+    float  maxNormalError;           // degrees
+    float  maxTexCoordError;
+};
+
+struct PackedMesh
+{
+    QVector<PackedVertex> vertices;
+    QVector<quint16>      indices16;  // filled when every index fits in 16 bits
+    QVector<unsigned int> indices32;  // otherwise
+    GLenum                indexType;
+    PackStats             stats;
+
+    const void *indexData() const;
+    int         indexBytes() const;
+};
+
+class VertexFormat
+{
+public:
+    static PackedMesh pack(const float *v, const float *n, const float *tc, int nVerts,
+                           const unsigned int *elems, int nIndices);
+
+    // Unit normal to/from the octahedron folded onto [-1,1]^2, as decoded by vshader.txt
+    static void octEncode(const float n[3], qint16 out[2]);
+    static void octDecode(const qint16 in[2], float n[3]);
+
+    // IEEE half precision, round to nearest even
+    static quint16 toHalf(float f);
+    static float   fromHalf(quint16 h);
+};
+
+#endif // VERTEXFORMAT_H